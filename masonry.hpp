@@ -1,7 +1,25 @@
+#pragma once
 #include <QLayout>
 #include <QWidget>
+#include <QtGlobal>
+#include <QtMath>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QByteArray>
+#include <QPointer>
 #include <stdexcept>
 #include <algorithm>
+#include <array>
+#include <optional>
+#include <functional>
+#include <memory>
+#include "masonry_perf.hpp"
+#include "masonry_memory.hpp"
+#include "masonry_compact_rects.hpp"
+#include "masonry_item_store.hpp"
+#include "masonry_render_cache.hpp"
+#include "masonry_impression.hpp"
 
 enum HorizontalAdaptationStrategy{
     NoAdaption,
@@ -14,7 +32,8 @@ typedef HorizontalAdaptationStrategy HAdapt;
 enum VerticalExpansionStrategy{
     HeightBalance,
     OrderInsert,
-    RandomInsert
+    RandomInsert,
+    ChoiceInsert
 };
 
 typedef VerticalExpansionStrategy VExpand;
@@ -27,6 +46,303 @@ enum OverflowStrategy{
 
 typedef OverflowStrategy Overflow;
 
+// The arithmetic of a pass, usable in constant expressions. zoomRects()
+// lays out a std::array of ratios for a given content width and column
+// count (a template argument, so the column heights fit in a std::array)
+// entirely at compile time; the result can be handed to
+// QMasonryFlowLayout::addStaticLayout() so a pass only applies the table.
+template<std::size_t N>
+struct QMasonryStaticLayout
+{
+    int content_width = 0;
+    int column_count = 0;
+    int horizontal_spacing = 0;
+    int vertical_spacing = 0;
+    VerticalExpansionStrategy vertical_expansion = HeightBalance;
+    int random_choices = 2;
+    quint64 random_seed = 0;
+    std::array<QRect,N> rects{};
+};
+
+class QMasonryPlacement
+{
+public:
+    static constexpr int columnCount(int content_width,int column_width,int spacing){
+        return std::max(1,std::max(1,content_width+spacing)/(column_width+spacing));
+    }
+
+    static constexpr int realColumnWidth(int content_width,int column_count,int spacing){
+        return (content_width-spacing*(column_count-1))/column_count;
+    }
+
+    static constexpr int itemLeft(int left,double column_width,int column_index,int spacing,int item_width){
+        return int(left+column_width*(column_index+0.5)+spacing*column_index-item_width/2);
+    }
+
+    // Random draws are a hash of the seed, the item index and the draw, so a
+    // pass resumed in the middle of the board repeats the same choices.
+    static constexpr quint64 randomValue(quint64 seed,int item_index,int draw){
+        quint64 value = seed+quint64(item_index)*0x9e3779b97f4a7c15ULL+quint64(draw)*0xd1b54a32d192ed03ULL;
+        value = (value^(value>>30))*0xbf58476d1ce4e5b9ULL;
+        value = (value^(value>>27))*0x94d049bb133111ebULL;
+        return value^(value>>31);
+    }
+
+    // ChoiceInsert samples random_choices columns and takes the shortest,
+    // which stays close to HeightBalance at a cost independent of the
+    // column count.
+    template<typename Heights>
+    static constexpr int selectColumn(VerticalExpansionStrategy strategy,int item_index,
+                                      const Heights& column_total_heights,int column_count,
+                                      int random_choices = 2,quint64 random_seed = 0){
+        switch (strategy) {
+            case HeightBalance:{
+                int target_column_index = 0;
+                int min_column_total_height = int(column_total_heights[0]);
+                for(int column_index=0;column_index<column_count;++column_index){
+                    int column_total_height = int(column_total_heights[column_index]);
+                    if(column_total_height<min_column_total_height){
+                        min_column_total_height = column_total_height;
+                        target_column_index = column_index;
+                    }
+                }
+                return target_column_index;
+            }
+            case OrderInsert:{
+                return item_index%column_count;
+            }
+            case RandomInsert:{
+                return int(randomValue(random_seed,item_index,0)%quint64(column_count));
+            }
+            case ChoiceInsert:{
+                int target_column_index = int(randomValue(random_seed,item_index,0)%quint64(column_count));
+                for(int draw=1;draw<random_choices;++draw){
+                    int column_index = int(randomValue(random_seed,item_index,draw)%quint64(column_count));
+                    if(column_total_heights[column_index]<column_total_heights[target_column_index]){
+                        target_column_index = column_index;
+                    }
+                }
+                return target_column_index;
+            }
+            default:{
+                throw std::runtime_error("Invalid vertical expansion strategy");
+            }
+        }
+    }
+
+    template<int ColumnCount,std::size_t N>
+    static constexpr QMasonryStaticLayout<N> zoomRects(const std::array<double,N>& ratios,
+                                                       int content_width,
+                                                       int horizontal_spacing,int vertical_spacing,
+                                                       VerticalExpansionStrategy strategy = HeightBalance,
+                                                       int random_choices = 2,quint64 random_seed = 0){
+        static_assert(ColumnCount>0,"A static layout needs at least one column");
+        QMasonryStaticLayout<N> layout;
+        layout.content_width = content_width;
+        layout.column_count = ColumnCount;
+        layout.horizontal_spacing = horizontal_spacing;
+        layout.vertical_spacing = vertical_spacing;
+        layout.vertical_expansion = strategy;
+        layout.random_choices = random_choices;
+        layout.random_seed = random_seed;
+
+        // The random strategies draw modulo the real column count, as a pass
+        // does, even when there are fewer items than columns.
+        std::array<double,ColumnCount> column_total_heights{};
+        zoomPlace(ratios.data(),0,int(N),ColumnCount,
+                  realColumnWidth(content_width,ColumnCount,horizontal_spacing),
+                  horizontal_spacing,vertical_spacing,strategy,random_choices,random_seed,
+                  column_total_heights.data(),layout.rects.data(),nullptr);
+        return layout;
+    }
+
+    // Zoom placement of a run of items from the origin: each takes the
+    // column strategy picks from the heights so far and fills it, one
+    // column width wide. column_total_heights carries over from one run to
+    // the next, so a board can be placed a run at a time; first_index is
+    // the board index of ratios[0], for the index-based strategies. columns
+    // may be null.
+    static constexpr void zoomPlace(const double* ratios,int first_index,int count,
+                                    int column_count,int column_width,int horizontal_spacing,int vertical_spacing,
+                                    VerticalExpansionStrategy strategy,int random_choices,quint64 random_seed,
+                                    double* column_total_heights,QRect* rects,int* columns){
+        for(int offset=0;offset<count;++offset){
+            int column_index = selectColumn(strategy,first_index+offset,column_total_heights,column_count,
+                                            random_choices,random_seed);
+            double item_height = column_width*ratios[offset];
+            rects[offset] = QRect((column_width+horizontal_spacing)*column_index,int(column_total_heights[column_index]),
+                                  column_width,int(item_height));
+            if(columns!=nullptr){
+                columns[offset] = column_index;
+            }
+            column_total_heights[column_index] += item_height+vertical_spacing;
+        }
+    }
+
+    // heights[i] = column_width*ratios[i]. A plain loop with no dependency
+    // between items, which compilers vectorize on their own.
+    static void zoomHeights(const double* ratios,int count,double column_width,double* heights){
+        for(int index=0;index<count;++index){
+            heights[index] = column_width*ratios[index];
+        }
+    }
+
+    // Zoom geometry of a run of items whose columns are already chosen, as
+    // a batched scalar kernel: the heights of a block are computed first,
+    // then each item is stacked on its column. Stacking stays scalar, as
+    // every item depends on the height its column reached before it.
+    // column_total_heights is advanced past the run and extents receives
+    // what every item added to its column.
+    static void zoomRun(const double* ratios,const int* columns,int count,
+                        int left,int top,int column_width,int horizontal_spacing,int vertical_spacing,
+                        double* column_total_heights,QRect* rects,double* extents){
+        constexpr int kBlock = 64;
+        double heights[kBlock];
+        for(int first=0;first<count;first+=kBlock){
+            int block = std::min(kBlock,count-first);
+            zoomHeights(ratios+first,block,column_width,heights);
+            for(int offset=0;offset<block;++offset){
+                int column_index = columns[first+offset];
+                double& column_total_height = column_total_heights[column_index];
+                rects[first+offset] = QRect(left+(column_width+horizontal_spacing)*column_index,
+                                            int(top+column_total_height),column_width,int(heights[offset]));
+                extents[first+offset] = heights[offset]+vertical_spacing;
+                column_total_height += heights[offset]+vertical_spacing;
+            }
+        }
+    }
+
+    template<int... ColumnCounts,std::size_t N>
+    static constexpr std::array<QMasonryStaticLayout<N>,sizeof...(ColumnCounts)> zoomRectTables(const std::array<double,N>& ratios,
+                                                                                              int content_width,
+                                                                                              int horizontal_spacing,int vertical_spacing,
+                                                                                              VerticalExpansionStrategy strategy = HeightBalance,
+                                                                                              int random_choices = 2,quint64 random_seed = 0){
+        return {{zoomRects<ColumnCounts>(ratios,content_width,horizontal_spacing,vertical_spacing,
+                           strategy,random_choices,random_seed)...}};
+    }
+};
+
+// Fixed-size slab allocator: objects allocated in a row sit next to each
+// other, and a freed slot is reused by the next allocation. Slabs are never
+// returned, and the pool itself is never destroyed so objects may outlive
+// static destruction. GUI thread only, like the layouts using it.
+template<typename T,int SlabSize = 1024>
+class QMasonrySlabPool
+{
+public:
+    static void* allocate(){
+        Pool& pool = instance();
+        if(pool.free_list==nullptr){
+            pool.addSlab();
+        }
+        Slot* slot = pool.free_list;
+        pool.free_list = slot->next;
+        return slot;
+    }
+
+    static void release(void* pointer){
+        Pool& pool = instance();
+        Slot* slot = static_cast<Slot*>(pointer);
+        slot->next = pool.free_list;
+        pool.free_list = slot;
+    }
+private:
+    union Slot{
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct Pool{
+        Slot* free_list = nullptr;
+
+        void addSlab(){
+            Slot* slab = new Slot[SlabSize];
+            for(int index=SlabSize-1;index>=0;--index){
+                slab[index].next = free_list;
+                free_list = &slab[index];
+            }
+        }
+    };
+
+    static Pool& instance(){
+        static Pool* pool = new Pool;
+        return *pool;
+    }
+};
+
+// The item wrapper of every widget the layout adds itself. It comes from a
+// slab pool, yet is deleted like any QLayoutItem, so whoever takes it
+// through takeAt() owns it as usual. It also keeps the widget's size hint
+// until invalidate(), so a pass reads it without calling into the widget.
+class QMasonryWidgetItem : public QWidgetItem
+{
+public:
+    using QWidgetItem::QWidgetItem;
+
+    QSize widgetSizeHint() const{
+        if(!m_widget_size_hint.isValid()){
+            m_widget_size_hint = widget()->sizeHint();
+        }
+        return m_widget_size_hint;
+    }
+
+    void invalidate() override{
+        m_widget_size_hint = QSize();
+        QWidgetItem::invalidate();
+    }
+
+    static void* operator new(std::size_t size){
+        if(size!=sizeof(QMasonryWidgetItem)){
+            return ::operator new(size);
+        }
+        return QMasonrySlabPool<QMasonryWidgetItem>::allocate();
+    }
+
+    static void operator delete(void* pointer,std::size_t size){
+        if(size!=sizeof(QMasonryWidgetItem)){
+            ::operator delete(pointer);
+            return;
+        }
+        QMasonrySlabPool<QMasonryWidgetItem>::release(pointer);
+    }
+private:
+    mutable QSize m_widget_size_hint;
+};
+
+// Accumulated cost of the passes run by a QMasonryFlowLayout. Hardware
+// counters stay at -1 unless they were enabled and are readable.
+struct QMasonryLayoutStats
+{
+    qint64 passes = 0;
+    qint64 computed_items = 0;
+    qint64 committed_items = 0;
+    qint64 nsecs = 0;
+    qint64 degraded_passes = 0;
+    qint64 suppressed_passes = 0;
+    qint64 counters[QMasonryPerfCounters::CounterCount] = {-1,-1,-1,-1};
+
+    QString summary() const{
+        qint64 items = std::max<qint64>(1,computed_items);
+        QString text = QStringLiteral("passes=%1 items=%2 ns/item=%3")
+                           .arg(passes).arg(computed_items).arg(double(nsecs)/items,0,'f',1);
+        if(degraded_passes>0){
+            text += QStringLiteral(" degraded=%1").arg(degraded_passes);
+        }
+        if(suppressed_passes>0){
+            text += QStringLiteral(" suppressed=%1").arg(suppressed_passes);
+        }
+        for(int counter=0;counter<QMasonryPerfCounters::CounterCount;++counter){
+            if(counters[counter]>=0){
+                text += QStringLiteral(" %1/item=%2")
+                            .arg(QMasonryPerfCounters::name(QMasonryPerfCounters::Counter(counter)))
+                            .arg(double(counters[counter])/items,0,'f',1);
+            }
+        }
+        return text;
+    }
+};
+
 class QMasonryFlowLayout : public QLayout
 {
     Q_OBJECT
@@ -52,12 +368,42 @@ public:
 
         m_items.clear();
         m_item_ratios.clear();
+
+        m_placement_timer = new QTimer(this);
+        m_placement_timer->setSingleShot(true);
+        m_placement_timer->setInterval(0);
+        connect(m_placement_timer,&QTimer::timeout,this,[this](){
+            continuePlacement();
+        });
+
+        m_memory_budget.addConsumer(&m_page_consumer);
+        m_memory_budget.addConsumer(&m_render_cache_consumer);
+
+        m_degraded_timer = new QTimer(this);
+        m_degraded_timer->setSingleShot(true);
+        connect(m_degraded_timer,&QTimer::timeout,this,[this](){
+            restoreExpansion();
+        });
+
+        m_render_cache_timer = new QTimer(this);
+        m_render_cache_timer->setSingleShot(true);
+        connect(m_render_cache_timer,&QTimer::timeout,this,[this](){
+            refreshRenderCache();
+        });
+    }
+
+    ~QMasonryFlowLayout(){
+        for(QLayoutItem* item:m_items){
+            delete item;
+        }
     }
 
 private:
     HorizontalAdaptationStrategy m_horizontal_adaption = Zoom;
     VerticalExpansionStrategy m_vertical_expansion = HeightBalance;
     OverflowStrategy m_overflow = AutoZoom;
+    int m_random_choices = 2;
+    quint64 m_random_seed = 0;
 
     std::optional<int> m_column_count;
     std::optional<int> m_column_width;
@@ -67,9 +413,142 @@ private:
 
     QList<QLayoutItem*> m_items;
     QList<double> m_item_ratios;
+    QList<QString> m_item_keys;
+    QList<QSize> m_item_size_hints;
+    QList<bool> m_item_placed;
+    QList<int> m_item_columns;
+
+    // Computed geometry is kept in pages of m_page_size items. Each page keeps
+    // the column heights in front of its first item, so a discarded page can be
+    // recomputed on its own and resuming a pass never walks earlier pages.
+    struct LayoutPage{
+        QList<double> column_heights;
+        QList<QRect> rects;
+        QList<QSize> fixed_sizes;
+        QList<int> columns;
+        QList<double> extents;
+        QByteArray compact_rects;
+        QRect bounds;
+        bool resident = false;
+        quint64 last_used = 0;
+    };
+    QList<LayoutPage> m_pages;
+    int m_page_size = 256;
+    quint64 m_page_clock = 0;
+
+    class LayoutPageConsumer : public QMasonryMemoryConsumer
+    {
+    public:
+        explicit LayoutPageConsumer(QMasonryFlowLayout* layout): m_layout(layout){}
+
+        qint64 memoryUsage() const override{
+            return m_layout->layoutMemoryUsage();
+        }
+        qint64 releaseMemory(qint64 bytes,const QRect& keep_rect) override{
+            return m_layout->releasePages(bytes,keep_rect);
+        }
+    private:
+        QMasonryFlowLayout* m_layout;
+    };
+    LayoutPageConsumer m_page_consumer{this};
+
+    class RenderCacheConsumer : public QMasonryMemoryConsumer
+    {
+    public:
+        explicit RenderCacheConsumer(QMasonryFlowLayout* layout): m_layout(layout){}
+
+        qint64 memoryUsage() const override{
+            return m_layout->renderCacheMemoryUsage();
+        }
+        qint64 releaseMemory(qint64 bytes,const QRect& keep_rect) override{
+            return m_layout->releaseRenderCache(bytes,keep_rect);
+        }
+    private:
+        QMasonryFlowLayout* m_layout;
+    };
+    RenderCacheConsumer m_render_cache_consumer{this};
+    QMasonryMemoryBudget m_memory_budget;
+
+    int m_dirty_index = 0;
+    int m_committed_index = 0;
+    QList<QPointer<QWidget>> m_changed_widgets;
+    bool m_size_hints_stale = false;
+    QHash<QWidget*,int> m_widget_indexes;
+    bool m_widget_indexes_stale = false;
+    QRect m_layout_rect;
+    QMargins m_layout_margins;
+    int m_layout_content_width = -1;
+    QPoint m_layout_offset;
+
+    bool m_lazy_placement = false;
+    int m_lazy_placement_margin = 0;
+    int m_placement_chunk_msecs = 8;
+    QTimer* m_placement_timer = nullptr;
+
+    QMasonryLayoutStats m_stats;
+    std::unique_ptr<QMasonryPerfCounters> m_perf_counters;
+
+    struct StaticLayout{
+        int content_width;
+        int column_count;
+        int horizontal_spacing;
+        int vertical_spacing;
+        VerticalExpansionStrategy vertical_expansion;
+        int random_choices;
+        quint64 random_seed;
+        const QRect* rects;
+        int rect_count;
+    };
+    // Index into m_static_layouts, which appending may move, or -1.
+    QList<StaticLayout> m_static_layouts;
+    int m_static_layout = -1;
+
+    int m_target_size_quantum = 32;
+    int m_target_width = 0;
+
+    int m_latency_budget_msecs = 0;
+    int m_degraded_settle_msecs = 150;
+    bool m_degraded = false;
+    QTimer* m_degraded_timer = nullptr;
+    int m_committed_column_count = 0;
+
+    int m_oscillation_window_msecs = 500;
+    QElapsedTimer m_width_change_timer;
+    int m_previous_layout_width = -1;
+    int m_settled_width = 0;
+    int m_settled_band = 0;
+
+    int m_feed_window = -1;
+    qint64 m_evicted_count = 0;
+    QList<double> m_column_base_heights;
+
+    int m_board_page_height = 0;
+    int m_current_board_page = 0;
+    QList<QList<int>> m_board_page_items;
+
+    std::shared_ptr<QMasonryItemStore> m_item_store;
+    std::function<QWidget*(const QString&)> m_create_widget;
+    bool m_syncing_item_store = false;
+
+    QList<QPointer<QMasonryRenderProxy>> m_render_proxies;
+    int m_render_cache_idle_msecs = 300;
+    QTimer* m_render_cache_timer = nullptr;
+
+    // The tracker holds placement coordinates, which moving the layout
+    // doesn't change, up to the first item it hasn't been given yet.
+    QPointer<QMasonryImpressionTracker> m_impression_tracker;
+    int m_impression_first_index = 0;
 public:
+    // Tile events are not watched under Zoom, so cached size hints are
+    // dropped when switching.
     void setHorizontalAdaption(HorizontalAdaptationStrategy strategy){
+        if(strategy!=m_horizontal_adaption){
+            for(QLayoutItem* item:m_items){
+                item->invalidate();
+            }
+        }
         m_horizontal_adaption = strategy;
+        markDirty(0);
     }
     HorizontalAdaptationStrategy horizontalAdaption() const{
         return m_horizontal_adaption;
@@ -77,19 +556,40 @@ public:
 
     void setVerticalExpansion(VerticalExpansionStrategy strategy){
         m_vertical_expansion = strategy;
+        markDirty(0);
     }
     VerticalExpansionStrategy verticalExpansion() const{
         return m_vertical_expansion;
     }
 
+    // Number of columns ChoiceInsert samples per item, at least 1.
+    void setRandomChoices(int choices){
+        m_random_choices = std::max(1,choices);
+        markDirty(0);
+    }
+    int randomChoices() const{
+        return m_random_choices;
+    }
+
+    // Seed of RandomInsert and ChoiceInsert; equal seeds give equal layouts.
+    void setRandomSeed(quint64 seed){
+        m_random_seed = seed;
+        markDirty(0);
+    }
+    quint64 randomSeed() const{
+        return m_random_seed;
+    }
+
     void setOverflow(OverflowStrategy strategy){
         m_overflow = strategy;
+        markDirty(0);
     }
     OverflowStrategy overflow() const{
         return m_overflow;
     }
     void setColumnCount(int count){
         m_column_count = count;
+        markDirty(0);
     }
 
     int columnCount() const{
@@ -97,6 +597,7 @@ public:
     }
     void setColumnWidth(qint64 width){
         m_column_width = width;
+        markDirty(0);
     }
 
     int columnWidth() const{
@@ -104,6 +605,7 @@ public:
     }
     void setHorizontalSpacing(int spacing){
         m_horizontal_spacing = spacing;
+        markDirty(0);
     }
 
     int horizontalSpacing() const{
@@ -112,175 +614,1688 @@ public:
 
     void setVerticalSpacing(int spacing){
         m_vertical_spacing = spacing;
+        markDirty(0);
     }
     int verticalSpacing() const{
         return m_vertical_spacing;
     }
 
-    void addItem(QLayoutItem *item) override{
-        m_items.append(item);
-        QWidget*widget = item->widget();
-        if(widget!= nullptr){
-            m_item_ratios.append(double(widget->height())/widget->width());
+    // With lazy placement, a pass stops placing never-placed items once every
+    // column is past the bottom of the visible area plus the margin; the rest
+    // are placed in time-boxed chunks from the event loop.
+    void setLazyPlacement(bool enabled){
+        m_lazy_placement = enabled;
+    }
+    bool lazyPlacement() const{
+        return m_lazy_placement;
+    }
+
+    void setLazyPlacementMargin(int margin){
+        m_lazy_placement_margin = margin;
+    }
+    int lazyPlacementMargin() const{
+        return m_lazy_placement_margin;
+    }
+
+    bool isPlacementPending() const{
+        return m_dirty_index<m_items.length();
+    }
+
+    // With a latency budget, a resize pass that takes longer than msecs
+    // switches the layout to a cheap column selection for the passes that
+    // follow: every item keeps the column it was last committed to, or goes
+    // round-robin when the column count changed. Once no pass has run for
+    // the settle time, the configured strategy is restored with a full pass.
+    // 0 disables it.
+    void setLatencyBudget(int msecs){
+        m_latency_budget_msecs = std::max(0,msecs);
+        if(m_latency_budget_msecs==0 && m_degraded){
+            restoreExpansion();
         }
     }
+    int latencyBudget() const{
+        return m_latency_budget_msecs;
+    }
 
-    QSize sizeHint() const override{
-        return QLayout::minimumSize();
+    void setDegradedSettleTime(int msecs){
+        m_degraded_settle_msecs = std::max(0,msecs);
+    }
+    int degradedSettleTime() const{
+        return m_degraded_settle_msecs;
     }
 
-    void setGeometry(const QRect &rect) override{
-        QLayout::setGeometry(rect);
-        doLayout(rect);
+    bool isDegraded() const{
+        return m_degraded;
     }
 
-    QLayoutItem * itemAt(int index) const override{
-        if(index>=0 && index<m_items.length()){
-            return nullptr;
+    // Inside a scroll area, a board about as tall as the viewport can make
+    // the vertical scrollbar come and go, flipping the width between two
+    // values on every pass. When the width goes back to the one before the
+    // last within msecs, the layout settles on the narrower of the two and
+    // lays out any width up to the wider one at that width, until a resize
+    // leaves that range. 0 disables it.
+    void setOscillationWindow(int msecs){
+        m_oscillation_window_msecs = std::max(0,msecs);
+        m_settled_width = 0;
+    }
+    int oscillationWindow() const{
+        return m_oscillation_window_msecs;
+    }
+
+    bool isWidthSettled() const{
+        return m_settled_width>0;
+    }
+
+    // Bounded feed mode: once a whole layout page of items lies more than
+    // distance pixels above the visible area, its items are deleted and the
+    // board moves up by the height of the shortest column above the rest,
+    // so a feed that appends forever keeps a constant widget count and pass
+    // cost. itemsEvicted() tells by how much to scroll back. Negative
+    // disables it.
+    void setFeedWindow(int distance){
+        m_feed_window = distance;
+    }
+    int feedWindow() const{
+        return m_feed_window;
+    }
+
+    // Number of items evicted from the front of the feed so far. Item
+    // indexes of the layout start after them.
+    qint64 evictedCount() const{
+        return m_evicted_count;
+    }
+
+    // Paginated mode: the board is cut into pages of the given height and
+    // an item that would straddle a page break starts its column on the next
+    // page instead. Only the items of the current page are laid out at the
+    // top of the parent; the others stay parked above it, so flipping pages
+    // touches only the items of the two pages. 0 turns it off.
+    void setBoardPageHeight(int height){
+        m_board_page_height = std::max(0,height);
+        m_board_page_items.clear();
+        markDirty(0);
+    }
+    int boardPageHeight() const{
+        return m_board_page_height;
+    }
+
+    int boardPageCount() const{
+        return m_board_page_items.length();
+    }
+
+    void setCurrentBoardPage(int board_page){
+        board_page = std::max(0,board_page);
+        if(board_page==m_current_board_page){
+            return;
         }
-        return m_items.at(index);
+        int last_board_page = m_current_board_page;
+        m_current_board_page = board_page;
+        for(int item_index:m_board_page_items.value(last_board_page)){
+            residentPage(item_index/m_page_size);
+            commitItem(item_index);
+        }
+        for(int item_index:m_board_page_items.value(board_page)){
+            residentPage(item_index/m_page_size);
+            commitItem(item_index);
+        }
+        updateImpressions();
+    }
+    int currentBoardPage() const{
+        return m_current_board_page;
     }
 
-    QLayoutItem *takeAt(int index){
-        if(index>=0 && index<m_items.length()){
-            return nullptr;
+    // Indexes of the items placed on board_page, in item order.
+    QList<int> boardPageItems(int board_page) const{
+        return m_board_page_items.value(board_page);
+    }
+
+    void addItem(QLayoutItem *item) override{
+        QWidget*widget = item->widget();
+        if(!m_syncing_item_store){
+            detachItemStore();
+            m_item_ratios.append(widget!=nullptr ? double(widget->height())/widget->width() : 0);
+        }
+        m_items.append(item);
+        m_item_keys.append(QString());
+        m_item_size_hints.append(QSize());
+        m_item_placed.append(false);
+        m_item_columns.append(-1);
+        markDirty(m_items.length()-1);
+        if(widget!=nullptr){
+            watchWidget(widget,m_items.length()-1);
+        }
+
+        if(m_lazy_placement && widget!=nullptr){
+            widget->move(0,-widget->height());
         }
-        return m_items.takeAt(index);
     }
 
-    int count() const override{
-        return m_items.length();
+    // Like QLayout::addWidget(), with the item from the slab pool.
+    void addWidget(QWidget *widget){
+        addChildWidget(widget);
+        addItem(new QMasonryWidgetItem(widget));
     }
-private:
-    void calculateColumnCount(const QRect& rect){
-        QMargins margin = contentsMargins();
-        int space_x = m_horizontal_spacing;
 
-        int column_count = std::max(1,rect.width()-margin.left()-margin.right()+space_x)/(m_column_width.value_or(0)+space_x);
-        m_column_count = column_count;
+    void addWidget(QWidget *widget,const QString& key){
+        addWidget(widget);
+        m_item_keys.last() = key;
     }
 
-    void handleOverflow(QLayoutItem*&item){
-        QWidget* item_widget = item->widget();
-        int item_height = item_widget->sizeHint().height();
-        int item_width = item_widget->sizeHint().width();
+    QString itemKey(int index) const{
+        return m_item_keys.value(index);
+    }
 
-        if(item_widget->width()!=columnWidth()){
-            switch (m_overflow)
-            {
-                case AutoZoom: {
-                    int column_height = item_height * columnWidth() / item_width;
-                    item_widget->setFixedSize(columnWidth(), column_height);
-                    break;
-                }
-                case AutoCrop:{
-                    item_widget->setFixedWidth(columnWidth());
-                    break;
-                }
-                case Ignore:{
-                    break;
-                }
-                default:{
-                    throw std::runtime_error("Invalid overflow strategy");
-                }
+    // Replaces the items with one per key. Items whose key is already present
+    // keep their widget and cached sizes, the others are created through
+    // create_widget; items whose key is gone are deleted. Placement restarts
+    // at the first position whose item changed. Returns the reused count.
+    int setItems(const QList<QString>& keys,const std::function<QWidget*(const QString&)>& create_widget){
+        if(!m_syncing_item_store){
+            detachItemStore();
+        }
+        QHash<QString,int> old_indexes;
+        for(int index=m_items.length()-1;index>=0;--index){
+            if(!m_item_keys[index].isEmpty()){
+                old_indexes.insert(m_item_keys[index],index);
             }
         }
-    }
 
-    int handleColumnSelection(int item_index,const QList<double>& column_total_heights){
-        int target_column_index = 0;
-        switch (m_vertical_expansion) {
-            case HeightBalance:{
-                int min_column_total_height = column_total_heights[0];
-                for(int column_index=0;column_index<m_column_count.value_or(0);++column_index){
-                    int column_total_height = column_total_heights[column_index];
-                    if(column_total_height<min_column_total_height){
-                        min_column_total_height = column_total_height;
-                        target_column_index = column_index;
-                    }
+        QList<int> order;
+        QList<bool> reused(m_items.length(),false);
+        int reused_count = 0;
+        for(const QString& key:keys){
+            int old_index = old_indexes.value(key,-1);
+            if(old_index>=0 && !reused[old_index]){
+                reused[old_index] = true;
+                ++reused_count;
+            }else{
+                old_index = -1;
+            }
+            order.append(old_index);
+        }
+
+        for(int index=0;index<m_items.length();++index){
+            if(!reused[index]){
+                QLayoutItem*item = m_items[index];
+                if(QWidget*widget = item->widget()){
+                    widget->hide();
+                    widget->deleteLater();
                 }
-                break;
+                delete item;
             }
-            case OrderInsert:{
-                target_column_index = item_index%m_column_count.value_or(0);
+        }
+
+        int first_changed_index = std::min<int>(order.length(),m_items.length());
+        for(int index=0;index<first_changed_index;++index){
+            if(order[index]!=index){
+                first_changed_index = index;
                 break;
             }
-            case RandomInsert:{
-                target_column_index = int(rand())%m_column_count.value_or(0);
-            }
-            default:{
-                throw std::runtime_error("Invalid vertical expansion strategy");
-            }
         }
-        return target_column_index;
-    }
-
-    void handlePosition(const QRect&rect,
-                        int target_column_index,QList<double>& column_total_heights,
-                        QLayoutItem*&item,double item_ratio,
-                        QRect& out_rect){
-        QMargins margin = contentsMargins();
-        int space_x = m_horizontal_spacing;
-        int space_y = m_vertical_spacing;
-        int item_width = item->widget()->sizeHint().width();
-        int item_height = item->widget()->sizeHint().height();
-        QWidget*item_widget = item->widget();
-
-        auto getItemTopLeft = [&](double column_width,int& out_x,int&out_y){
-            out_x = margin.left() + column_width*(target_column_index+0.5)+space_x*target_column_index - item_width/2;
-            out_y = margin.top() + column_total_heights[target_column_index];
-        };
 
-        auto getRealColumnWidth = [&](int column_index){
-            return (rect.width()-margin.left()-margin.right()-space_x*(m_column_count.value_or(0)-1))/m_column_count.value_or(0);
-        };
+        m_items = reordered(m_items,order,static_cast<QLayoutItem*>(nullptr));
+        if(m_item_store==nullptr){
+            m_item_ratios = reordered(m_item_ratios,order,0.0);
+        }
+        m_item_keys = keys;
+        m_item_size_hints = reordered(m_item_size_hints,order,QSize());
+        m_item_placed = reordered(m_item_placed,order,false);
+        m_item_columns = reordered(m_item_columns,order,-1);
+        m_widget_indexes_stale = true;
 
-        int x=0,y=0;
-        switch (m_horizontal_adaption) {
-            case NoAdaption:{
-                getItemTopLeft(columnWidth(),x,y);
-                column_total_heights[target_column_index] += item_height+space_y;
-                break;
-            }
-            case Spacing:{
-                int real_column_width = getRealColumnWidth(target_column_index);
-                getItemTopLeft(real_column_width,x,y);
-                column_total_heights[target_column_index] += item_height+space_y;
-                break;
+        for(int index=0;index<order.length();++index){
+            if(order[index]>=0){
+                continue;
             }
-            case Zoom:{
-                double real_column_width = getRealColumnWidth(target_column_index);
-                getItemTopLeft(real_column_width,x,y);
-                double column_height = real_column_width*item_ratio;
-                item_widget->setFixedSize(QSize(real_column_width, column_height));
-                column_total_heights[target_column_index] += column_height+space_y;
-                break;
+            QWidget*widget = create_widget(keys[index]);
+            addChildWidget(widget);
+            m_items[index] = new QMasonryWidgetItem(widget);
+            widget->installEventFilter(this);
+            if(m_item_store==nullptr){
+                m_item_ratios[index] = double(widget->height())/widget->width();
             }
-            default:{
-                throw std::runtime_error("Invalid horizontal adaptation strategy");
+            if(m_lazy_placement){
+                widget->move(0,-widget->height());
             }
         }
-        out_rect.setRect(x,y,item_width,item_height);
-    }
 
-    QSize doLayout(const QRect& rect){
-        calculateColumnCount(rect);
-        QList<double> column_total_heights(m_column_count.value_or(0),0);
-        QRect position;
+        markDirty(first_changed_index);
+        m_committed_index = std::min(m_committed_index,first_changed_index);
+        invalidate();
+        return reused_count;
+    }
 
-        for(int item_index = 0;item_index<m_items.size();++item_index){
-            QLayoutItem*item = m_items[item_index];
-            handleOverflow(item);
+    // Shows the items of store, which other layouts may show as well: the
+    // store's ratios are read in place, appends to it only add widgets from
+    // create_widget here, and each layout keeps its own geometry. Changing
+    // the items of the layout directly (adding, taking, setItems(), feed
+    // eviction) gives it a private copy of the ratios and leaves the store.
+    void setItemStore(const std::shared_ptr<QMasonryItemStore>& store,
+                      const std::function<QWidget*(const QString&)>& create_widget){
+        detachItemStore();
+        if(store==nullptr){
+            return;
+        }
+        m_item_store = store;
+        m_create_widget = create_widget;
+        connect(store.get(),&QMasonryItemStore::itemsAppended,this,[this](int first,int count){
+            appendStoreItems(first,count);
+        });
+        connect(store.get(),&QMasonryItemStore::itemChanged,this,[this](int index){
+            itemChanged(index);
+        });
+        connect(store.get(),&QMasonryItemStore::itemsReset,this,[this](){
+            resetStoreItems();
+        });
+        resetStoreItems();
+    }
+    std::shared_ptr<QMasonryItemStore> itemStore() const{
+        return m_item_store;
+    }
 
-            double item_ratio = m_item_ratios[item_index];
-            int target_column_index = handleColumnSelection(item_index,column_total_heights);
-            handlePosition(rect,
-                           target_column_index,column_total_heights,
-                           item,item_ratio,
-                           position);
+    // Tiles marked here are drawn from a snapshot while the board scrolls or
+    // is laid out again, and are live again once the board has been idle for
+    // the idle time or the pointer enters them. Snapshots are taken while
+    // idle, a time-boxed chunk at a time, starting with the visible tiles.
+    void setRenderCached(QWidget *widget,bool cached){
+        QMasonryRenderProxy* proxy = renderProxy(widget);
+        if(cached && proxy==nullptr && widget!=nullptr){
+            m_render_proxies.append(new QMasonryRenderProxy(widget));
+            m_render_cache_timer->start(m_render_cache_idle_msecs);
+        }else if(!cached && proxy!=nullptr){
+            m_render_proxies.removeAll(proxy);
+            delete proxy;
+        }
+    }
+    bool isRenderCached(QWidget *widget) const{
+        return renderProxy(widget)!=nullptr;
+    }
 
-            item->setGeometry(position);
+    // Drops the snapshot of a tile whose content changed; a new one is taken
+    // the next time the board is idle.
+    void invalidateRenderCache(QWidget *widget){
+        if(QMasonryRenderProxy* proxy = renderProxy(widget)){
+            proxy->invalidate();
+            m_render_cache_timer->start(m_render_cache_idle_msecs);
+        }
+    }
+
+    void setRenderCacheIdleTime(int msecs){
+        m_render_cache_idle_msecs = std::max(0,msecs);
+    }
+    int renderCacheIdleTime() const{
+        return m_render_cache_idle_msecs;
+    }
+
+    // Marks the item at index as changed, so the next pass restarts placement
+    // from it and keeps every tile before it where it is.
+    void itemChanged(int index){
+        if(index<0 || index>=m_items.length()){
+            return;
+        }
+        m_items[index]->invalidate();
+        invalidateRenderCache(m_items[index]->widget());
+        markDirty(index);
+        invalidate();
+    }
+
+    // An invalidation no tile event was noted for, e.g. the updateGeometry()
+    // of a QLabel given new text, makes the next pass compare every hint.
+    void invalidate() override{
+        if(m_changed_widgets.isEmpty()){
+            m_size_hints_stale = true;
+        }
+        QLayout::invalidate();
+        if(m_placement_timer!=nullptr && isDeferred() && m_layout_rect.isValid()){
+            m_placement_timer->start();
+        }
+    }
+
+    QSize sizeHint() const override{
+        return QLayout::minimumSize();
+    }
+
+    void setGeometry(const QRect &rect) override{
+        QLayout::setGeometry(rect);
+        doLayout(rect);
+    }
+
+    QLayoutItem * itemAt(int index) const override{
+        if(index<0 || index>=m_items.length()){
+            return nullptr;
+        }
+        return m_items.at(index);
+    }
+
+    QLayoutItem *takeAt(int index) override{
+        if(index<0 || index>=m_items.length()){
+            return nullptr;
+        }
+        detachItemStore();
+        m_item_ratios.removeAt(index);
+        m_item_keys.removeAt(index);
+        m_item_size_hints.removeAt(index);
+        m_item_placed.removeAt(index);
+        m_item_columns.removeAt(index);
+        markDirty(index);
+        m_committed_index = std::min(m_committed_index,index);
+        if(QWidget*widget = m_items[index]->widget()){
+            widget->removeEventFilter(this);
+        }
+        m_widget_indexes_stale = true;
+        return m_items.takeAt(index);
+    }
+
+    int count() const override{
+        return m_items.length();
+    }
+
+    void setLayoutPageSize(int size){
+        m_page_size = std::max(1,size);
+        m_pages.clear();
+        markDirty(0);
+    }
+    int layoutPageSize() const{
+        return m_page_size;
+    }
+
+    // Geometry computed for the item at index, recomputing its page from the
+    // page checkpoint if it was discarded. Invalid while the item is pending.
+    QRect itemRect(int index){
+        return itemRects(index,index+1).value(0);
+    }
+
+    // Geometry of the items in [first, last), decoding compacted pages and
+    // recomputing discarded ones once per page.
+    QList<QRect> itemRects(int first,int last){
+        QList<QRect> rects = placedRects(first,last);
+        for(QRect& rect:rects){
+            rect.translate(m_layout_offset);
+        }
+        return rects;
+    }
+
+    // Drops the geometry of committed pages lying more than distance pixels
+    // above or below the visible area. Returns the number of pages discarded.
+    int discardLayoutPages(int distance){
+        return releaseLayoutPages(distance,false);
+    }
+
+    // Like discardLayoutPages(), but keeps the rects of those pages as
+    // per-column varint deltas so they can be read back without recomputing.
+    int compactLayoutPages(int distance){
+        return releaseLayoutPages(distance,true);
+    }
+
+    // Registers a table built by QMasonryPlacement::zoomRects() from the item
+    // ratios. While the layout is in Zoom mode with matching width, column
+    // count, spacings and strategy, items covered by the table take their
+    // rect from it instead of being placed. The table is not copied and must
+    // outlive the layout, so temporaries are refused.
+    template<std::size_t N>
+    void addStaticLayout(const QMasonryStaticLayout<N>&& layout) = delete;
+    template<std::size_t N>
+    void addStaticLayout(const QMasonryStaticLayout<N>& layout){
+        m_static_layouts.append({layout.content_width,layout.column_count,
+                                 layout.horizontal_spacing,layout.vertical_spacing,
+                                 layout.vertical_expansion,layout.random_choices,layout.random_seed,
+                                 layout.rects.data(),int(N)});
+        markDirty(0);
+    }
+
+    void clearStaticLayouts(){
+        m_static_layouts.clear();
+        m_static_layout = -1;
+        markDirty(0);
+    }
+
+    // Target sizes are in physical pixels, with the width rounded up to a
+    // multiple of the quantum so decoders and caches see few distinct sizes.
+    void setTargetSizeQuantum(int quantum){
+        m_target_size_quantum = std::max(1,quantum);
+        updateTargetWidth();
+    }
+    int targetSizeQuantum() const{
+        return m_target_size_quantum;
+    }
+
+    // The resolution an image shown in the item at index should be decoded
+    // at: its laid out width times the device pixel ratio, quantized, and
+    // the matching height for the item's ratio.
+    QSize itemTargetSize(int index) const{
+        if(index<0 || index>=m_items.length()){
+            return QSize();
+        }
+        int target_width = physicalWidth(logicalItemWidth(index));
+        return QSize(target_width,qRound(target_width*itemRatios()[index]));
+    }
+
+    const QMasonryLayoutStats& stats() const{
+        return m_stats;
+    }
+    void resetStats(){
+        m_stats = QMasonryLayoutStats();
+    }
+
+    // Reads cycles, instructions, cache and branch misses around every pass
+    // into stats(), where the platform allows it.
+    void setPerfCountersEnabled(bool enabled){
+        if(enabled && m_perf_counters==nullptr){
+            m_perf_counters = std::make_unique<QMasonryPerfCounters>();
+        }else if(!enabled){
+            m_perf_counters.reset();
+        }
+    }
+    bool perfCountersEnabled() const{
+        return m_perf_counters!=nullptr;
+    }
+
+    qint64 layoutMemoryUsage() const{
+        qint64 bytes = m_pages.capacity()*sizeof(LayoutPage);
+        for(const LayoutPage& page:m_pages){
+            bytes += pageMemoryUsage(page);
+        }
+        return bytes;
+    }
+
+    // The budget every layout-related cache registers with: the layout's own
+    // pages and render cache snapshots are registered already, and application caches (thumbnails,
+    // widget pools) can add themselves as QMasonryMemoryConsumer. It is
+    // enforced after every pass.
+    QMasonryMemoryBudget& memoryBudget(){
+        return m_memory_budget;
+    }
+
+    void setMemoryLimit(qint64 bytes){
+        m_memory_budget.setLimit(bytes);
+        enforceMemoryBudget();
+    }
+    qint64 memoryLimit() const{
+        return m_memory_budget.limit();
+    }
+
+    // Gives memory back beyond the budget, e.g. when the application is
+    // backgrounded. Moderate halves usage and Background empties the caches,
+    // both keeping a screen above and below the visible area; Complete
+    // keeps only what is visible.
+    void trimMemory(MemoryTrimLevel level){
+        QRect visible_rect = visibleRect();
+        QRect nearby_rect = visible_rect.adjusted(0,-visible_rect.height(),0,visible_rect.height());
+        switch (level) {
+            case TrimModerate:{
+                m_memory_budget.enforce(nearby_rect,m_memory_budget.usage()/2);
+                break;
+            }
+            case TrimBackground:{
+                m_memory_budget.enforce(nearby_rect,0);
+                break;
+            }
+            case TrimComplete:{
+                m_memory_budget.enforce(visible_rect,0);
+                break;
+            }
+            default:{
+                throw std::runtime_error("Invalid memory trim level");
+            }
+        }
+    }
+    // Feeds tracker the committed tile rects and the visible part of the
+    // parent, after every pass and whenever the parent moves, e.g. while a
+    // scroll area scrolls it. Both are in placement coordinates, relative to
+    // the layout's own origin, and a pass only hands over the tiles it
+    // committed.
+    void setImpressionTracker(QMasonryImpressionTracker* tracker){
+        m_impression_tracker = tracker;
+        m_impression_first_index = 0;
+        updateImpressions();
+    }
+    QMasonryImpressionTracker* impressionTracker() const{
+        return m_impression_tracker;
+    }
+protected:
+    // Events after which a tile's size hint may have changed. The tile is
+    // only noted here, as it has not handled the event yet; the next pass
+    // compares its hint and restarts placement from it if it moved.
+    bool eventFilter(QObject *watched,QEvent *event) override{
+        switch (event->type()) {
+            case QEvent::LayoutRequest:
+            case QEvent::Polish:
+            case QEvent::FontChange:
+            case QEvent::StyleChange:
+            case QEvent::ContentsRectChange:
+            case QEvent::ShowToParent:
+            case QEvent::HideToParent:{
+                if(m_horizontal_adaption!=Zoom && watched->isWidgetType()){
+                    m_changed_widgets.append(static_cast<QWidget*>(watched));
+                    invalidate();
+                }
+                break;
+            }
+            default:{
+                break;
+            }
+        }
+        return QLayout::eventFilter(watched,event);
+    }
+
+    void widgetEvent(QEvent *event) override{
+        QLayout::widgetEvent(event);
+        if(event->type()==QEvent::Show && m_committed_index<m_items.length() && geometry().isValid()){
+            doLayout(geometry());
+        }
+        if(event->type()==QEvent::Move){
+            engageRenderCache();
+            updateImpressions();
+        }
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+        if(event->type()==QEvent::DevicePixelRatioChange){
+            updateTargetWidth();
+        }
+#endif
+    }
+signals:
+    // Emitted when itemTargetSize() changes for the column width shared by
+    // tiles, after a resize or a move to a screen with another pixel ratio.
+    void itemTargetSizesChanged();
+
+    // Emitted after count items were evicted from the front of the feed and
+    // the remaining ones moved up by shift pixels.
+    void itemsEvicted(int count,int shift);
+private:
+    template<typename T>
+    static QList<T> reordered(const QList<T>& values,const QList<int>& order,const T& fallback){
+        QList<T> result;
+        result.reserve(order.length());
+        for(int index:order){
+            result.append(index>=0 ? values[index] : fallback);
+        }
+        return result;
+    }
+
+    const QList<double>& itemRatios() const{
+        return m_item_store!=nullptr ? m_item_store->ratios() : m_item_ratios;
+    }
+
+    void detachItemStore(){
+        if(m_item_store==nullptr){
+            return;
+        }
+        m_item_ratios = m_item_store->ratios();
+        m_item_ratios.resize(m_items.length());
+        disconnect(m_item_store.get(),nullptr,this,nullptr);
+        m_item_store.reset();
+        m_create_widget = nullptr;
+    }
+
+    void resetStoreItems(){
+        m_syncing_item_store = true;
+        setItems(m_item_store->keys(),m_create_widget);
+        m_syncing_item_store = false;
+    }
+
+    void appendStoreItems(int first_index,int count){
+        if(first_index!=m_items.length()){
+            resetStoreItems();
+            return;
+        }
+        m_syncing_item_store = true;
+        for(int index=first_index;index<first_index+count;++index){
+            QWidget*widget = m_create_widget(m_item_store->key(index));
+            addChildWidget(widget);
+            addItem(new QMasonryWidgetItem(widget));
+            m_item_keys.last() = m_item_store->key(index);
+        }
+        m_syncing_item_store = false;
+        invalidate();
+    }
+
+    QMasonryRenderProxy* renderProxy(QWidget *widget) const{
+        for(const QPointer<QMasonryRenderProxy>& proxy:m_render_proxies){
+            if(!proxy.isNull() && proxy->tile()==widget){
+                return proxy.data();
+            }
+        }
+        return nullptr;
+    }
+
+    // Scrolling or a pass has started: cover every cached tile that has a
+    // snapshot, and go live again once nothing happened for the idle time.
+    void engageRenderCache(){
+        if(m_render_proxies.isEmpty()){
+            return;
+        }
+        for(const QPointer<QMasonryRenderProxy>& proxy:m_render_proxies){
+            if(!proxy.isNull()){
+                proxy->engage();
+            }
+        }
+        m_render_cache_timer->start(m_render_cache_idle_msecs);
+    }
+
+    qint64 renderCacheMemoryUsage() const{
+        qint64 bytes = 0;
+        for(const QPointer<QMasonryRenderProxy>& proxy:m_render_proxies){
+            if(!proxy.isNull()){
+                bytes += proxy->snapshotBytes();
+            }
+        }
+        return bytes;
+    }
+
+    // Drops the snapshots of tiles furthest from keep_rect first and, at
+    // equal distance, the ones shown least recently, until bytes are freed.
+    // A dropped snapshot is taken again the next time the board is idle.
+    qint64 releaseRenderCache(qint64 bytes,const QRect& keep_rect){
+        QList<QMasonryRenderProxy*> candidates;
+        for(const QPointer<QMasonryRenderProxy>& proxy:m_render_proxies){
+            if(!proxy.isNull() && proxy->hasSnapshot()
+               && !proxy->tile()->geometry().translated(-m_layout_offset).intersects(keep_rect)){
+                candidates.append(proxy.data());
+            }
+        }
+        int center = keep_rect.center().y();
+        auto distance = [&](QMasonryRenderProxy* proxy){
+            QRect rect = proxy->tile()->geometry().translated(-m_layout_offset);
+            return std::max(rect.top()-center,center-rect.bottom());
+        };
+        std::sort(candidates.begin(),candidates.end(),[&](QMasonryRenderProxy* left,QMasonryRenderProxy* right){
+            int left_distance = distance(left);
+            int right_distance = distance(right);
+            if(left_distance!=right_distance){
+                return left_distance>right_distance;
+            }
+            return left->idleTime()>right->idleTime();
+        });
+
+        qint64 freed = 0;
+        for(QMasonryRenderProxy* proxy:candidates){
+            if(freed>=bytes){
+                break;
+            }
+            freed += proxy->snapshotBytes();
+            proxy->invalidate();
+        }
+        return freed;
+    }
+
+    void refreshRenderCache(){
+        m_render_proxies.removeAll(QPointer<QMasonryRenderProxy>());
+        for(const QPointer<QMasonryRenderProxy>& proxy:m_render_proxies){
+            proxy->release();
+        }
+        if(isDeferred()){
+            return;
+        }
+
+        QRect visible_rect = visibleRect().translated(m_layout_offset);
+        QList<QMasonryRenderProxy*> pending;
+        for(const QPointer<QMasonryRenderProxy>& proxy:m_render_proxies){
+            if(!proxy->hasSnapshot()){
+                pending.append(proxy.data());
+            }
+        }
+        std::stable_sort(pending.begin(),pending.end(),[&](QMasonryRenderProxy* left,QMasonryRenderProxy* right){
+            return left->tile()->geometry().intersects(visible_rect) && !right->tile()->geometry().intersects(visible_rect);
+        });
+
+        // Under a memory limit, snapshots are only taken while they fit, so
+        // the ones the budget dropped don't come back just to be dropped.
+        qint64 room = m_memory_budget.limit()>0 ? m_memory_budget.limit()-m_memory_budget.usage() : -1;
+        QElapsedTimer timer;
+        timer.start();
+        for(QMasonryRenderProxy* proxy:pending){
+            if(m_memory_budget.limit()>0 && room<=0){
+                return;
+            }
+            if(timer.hasExpired(m_placement_chunk_msecs)){
+                m_render_cache_timer->start(0);
+                return;
+            }
+            proxy->capture();
+            room -= proxy->snapshotBytes();
+        }
+    }
+
+    int realColumnWidth() const{
+        int column_count = std::max(1,m_column_count.value_or(1));
+        return QMasonryPlacement::realColumnWidth(std::max(0,m_layout_content_width),column_count,m_horizontal_spacing);
+    }
+
+    int logicalItemWidth(int index) const{
+        if(m_horizontal_adaption==Zoom){
+            return realColumnWidth();
+        }
+        if(m_overflow!=Ignore){
+            return columnWidth();
+        }
+        const QSize& size_hint = m_item_size_hints[index];
+        return size_hint.isValid() ? size_hint.width() : columnWidth();
+    }
+
+    int physicalWidth(int logical_width) const{
+        QWidget*widget = parentWidget();
+        qreal device_pixel_ratio = widget!=nullptr ? widget->devicePixelRatioF() : 1.0;
+        int width = qCeil(logical_width*device_pixel_ratio);
+        return (width+m_target_size_quantum-1)/m_target_size_quantum*m_target_size_quantum;
+    }
+
+    void updateTargetWidth(){
+        int target_width = physicalWidth(m_horizontal_adaption==Zoom ? realColumnWidth() : columnWidth());
+        if(target_width!=m_target_width){
+            m_target_width = target_width;
+            emit itemTargetSizesChanged();
+        }
+    }
+
+    // Tiles are watched for the events that come with a size hint change,
+    // and found again by widget when one arrives.
+    void watchWidget(QWidget *widget,int index){
+        widget->installEventFilter(this);
+        if(!m_widget_indexes_stale){
+            m_widget_indexes.insert(widget,index);
+        }
+    }
+
+    int widgetIndex(QWidget *widget){
+        if(widget==nullptr){
+            return -1;
+        }
+        if(m_widget_indexes_stale){
+            m_widget_indexes.clear();
+            for(int index=0;index<m_items.length();++index){
+                if(QWidget*item_widget = m_items[index]->widget()){
+                    m_widget_indexes.insert(item_widget,index);
+                }
+            }
+            m_widget_indexes_stale = false;
+        }
+        return m_widget_indexes.value(widget,-1);
+    }
+
+    void markDirty(int index){
+        m_dirty_index = std::min(m_dirty_index,index);
+    }
+
+    bool isRandomExpansion() const{
+        return m_vertical_expansion==RandomInsert || m_vertical_expansion==ChoiceInsert;
+    }
+
+    bool isDeferred() const{
+        QWidget* widget = parentWidget();
+        return widget!=nullptr && !widget->isVisible();
+    }
+
+    // Geometry is placed relative to the margins and content width of the
+    // last full pass. A change that keeps the content width (the layout rect
+    // moving, margins shifting from one side to the other) only changes
+    // m_layout_offset.
+    int updateDirtyIndex(const QRect& rect){
+        QMargins margin = contentsMargins();
+        int content_width = rect.width()-margin.left()-margin.right();
+        if(!m_layout_rect.isValid() || content_width!=m_layout_content_width){
+            m_layout_margins = margin;
+            m_layout_content_width = content_width;
+            m_dirty_index = 0;
+        }
+        m_layout_rect = rect;
+        m_dirty_index = std::min<int>(m_dirty_index,m_items.length());
+        for(const QPointer<QWidget>& widget:m_changed_widgets){
+            int item_index = widgetIndex(widget);
+            if(item_index>=0){
+                m_items[item_index]->invalidate();
+            }
+            if(item_index>=0 && item_index<m_dirty_index && itemSizeHint(item_index)!=m_item_size_hints[item_index]){
+                m_dirty_index = item_index;
+            }
+        }
+        m_changed_widgets.clear();
+        if(m_size_hints_stale && m_horizontal_adaption!=Zoom){
+            for(int item_index=0;item_index<m_dirty_index;++item_index){
+                m_items[item_index]->invalidate();
+                if(itemSizeHint(item_index)!=m_item_size_hints[item_index]){
+                    m_dirty_index = item_index;
+                }
+            }
+        }
+        m_size_hints_stale = false;
+        m_committed_index = std::min(m_committed_index,m_dirty_index);
+
+        int page_count = (m_items.length()+m_page_size-1)/m_page_size;
+        if(m_pages.length()>page_count){
+            m_pages.resize(page_count);
+        }
+
+        QPoint layout_offset = rect.topLeft()+QPoint(margin.left()-m_layout_margins.left(),margin.top()-m_layout_margins.top());
+        if(layout_offset!=m_layout_offset){
+            m_layout_offset = layout_offset;
+            translateCommittedItems();
+        }
+        return m_dirty_index;
+    }
+
+    // Moves the committed tiles to the current offset, without placing them
+    // again or touching their size.
+    void translateCommittedItems(){
+        for(int page_index=0;page_index*m_page_size<m_committed_index;++page_index){
+            const LayoutPage& page = residentPage(page_index);
+            int end_index = std::min((page_index+1)*m_page_size,m_committed_index);
+            for(int item_index=page_index*m_page_size;item_index<end_index;++item_index){
+                QLayoutItem*item = m_items[item_index];
+                QRect item_rect = displayRect(page.rects[item_index%m_page_size]);
+                if(QWidget*item_widget = item->widget()){
+                    item_widget->move(item_rect.topLeft());
+                }else{
+                    item->setGeometry(item_rect);
+                }
+            }
+        }
+    }
+
+    // Rects of the items in [first, last) in placement coordinates, decoding
+    // compacted pages and recomputing discarded ones once per page.
+    QList<QRect> placedRects(int first,int last){
+        first = std::max(first,0);
+        last = std::min(last,m_dirty_index);
+        QList<QRect> rects;
+        for(int page_index=first/m_page_size;first<last;++page_index){
+            int page_first = page_index*m_page_size;
+            int page_last = std::min(page_first+m_page_size,last);
+            LayoutPage& page = m_pages[page_index];
+            page.last_used = m_page_clock;
+            const QList<QRect>& page_rects = !page.resident && !page.compact_rects.isEmpty()
+                                                 ? QMasonryCompactRects::decode(page.compact_rects)
+                                                 : residentPage(page_index).rects;
+            for(int index=first;index<page_last;++index){
+                rects.append(page_rects[index-page_first]);
+            }
+            first = page_last;
+        }
+        return rects;
+    }
+
+    // Hands the tracker the items committed since it was last updated, which
+    // passes do before the memory budget may release their pages, so only a
+    // tracker set on a board with released pages reads those back. Paginated
+    // items are cut at the bottom of their page, as they are shown, and the
+    // viewport is moved onto the current page.
+    void updateImpressions(){
+        if(m_impression_tracker==nullptr){
+            return;
+        }
+        int first_index = std::min(m_impression_first_index,m_committed_index);
+        if(first_index<m_committed_index || m_impression_tracker->itemCount()!=m_committed_index){
+            QList<QRect> rects = placedRects(first_index,m_committed_index);
+            if(m_board_page_height>0){
+                for(QRect& rect:rects){
+                    rect &= boardPageRect(boardPageOf(rect),rect);
+                }
+            }
+            m_impression_tracker->setItemRects(first_index,rects);
+        }
+        m_impression_first_index = m_committed_index;
+
+        QRect viewport = visibleRect();
+        if(m_board_page_height>0){
+            viewport.translate(0,m_current_board_page*m_board_page_height);
+            viewport &= boardPageRect(m_current_board_page,viewport);
+        }
+        m_impression_tracker->setViewport(viewport);
+    }
+
+    // The band of board page board_page, as wide as rect.
+    QRect boardPageRect(int board_page,const QRect& rect) const{
+        return QRect(rect.left(),m_layout_margins.top()+board_page*m_board_page_height,rect.width(),m_board_page_height);
+    }
+
+    // Where a placed rect goes in the parent: moved by the layout offset and,
+    // when paginated, onto its board page or parked above the parent.
+    QRect displayRect(QRect item_rect) const{
+        if(m_board_page_height>0){
+            int board_page = boardPageOf(item_rect);
+            item_rect.translate(0,-board_page*m_board_page_height);
+            if(board_page!=m_current_board_page){
+                // Parked above the parent itself, like a lazily placed tile,
+                // not above the layout, which may sit below other widgets.
+                item_rect.translate(m_layout_offset.x(),0);
+                item_rect.moveTop(-item_rect.height());
+                return item_rect;
+            }
+        }
+        return item_rect.translated(m_layout_offset);
+    }
+
+    LayoutPage& pageFor(int item_index){
+        int page_index = item_index/m_page_size;
+        if(m_pages.length()<=page_index){
+            m_pages.resize(page_index+1);
+        }
+        LayoutPage& page = m_pages[page_index];
+        int offset = item_index%m_page_size;
+        if(page.rects.length()<=offset){
+            page.rects.resize(offset+1);
+            page.fixed_sizes.resize(offset+1);
+            page.columns.resize(offset+1);
+            page.extents.resize(offset+1);
+        }
+        return page;
+    }
+
+    static qint64 pageMemoryUsage(const LayoutPage& page){
+        return page.column_heights.capacity()*sizeof(double)
+               +page.rects.capacity()*sizeof(QRect)
+               +page.fixed_sizes.capacity()*sizeof(QSize)
+               +page.columns.capacity()*sizeof(int)
+               +page.extents.capacity()*sizeof(double)
+               +page.compact_rects.capacity();
+    }
+
+    static void dropPageGeometry(LayoutPage& page){
+        page.rects = QList<QRect>();
+        page.fixed_sizes = QList<QSize>();
+        page.columns = QList<int>();
+        page.extents = QList<double>();
+        page.resident = false;
+    }
+
+    static void compactPage(LayoutPage& page){
+        page.compact_rects = QMasonryCompactRects::encode(page.rects,page.columns,page.column_heights.length());
+        dropPageGeometry(page);
+    }
+
+    static void discardPage(LayoutPage& page){
+        page.compact_rects = QByteArray();
+        dropPageGeometry(page);
+    }
+
+    bool isPageReleasable(int page_index,const QRect& keep_rect) const{
+        const LayoutPage& page = m_pages[page_index];
+        bool committed = (page_index+1)*m_page_size<=m_committed_index;
+        bool holds_geometry = page.resident || !page.compact_rects.isEmpty();
+        return committed && holds_geometry && !page.bounds.intersects(keep_rect);
+    }
+
+    int releaseLayoutPages(int distance,bool compact){
+        QRect keep_rect = visibleRect().adjusted(0,-distance,0,distance);
+        int released_count = 0;
+        for(int page_index=0;page_index<m_pages.length();++page_index){
+            LayoutPage& page = m_pages[page_index];
+            if(!isPageReleasable(page_index,keep_rect) || (compact && !page.resident)){
+                continue;
+            }
+            if(compact){
+                compactPage(page);
+            }else{
+                discardPage(page);
+            }
+            ++released_count;
+        }
+        return released_count;
+    }
+
+    // Compacts, then discards, the pages furthest from keep_rect first and,
+    // at equal distance, the least recently used ones, until bytes are freed.
+    qint64 releasePages(qint64 bytes,const QRect& keep_rect){
+        QList<int> candidates;
+        for(int page_index=0;page_index<m_pages.length();++page_index){
+            if(isPageReleasable(page_index,keep_rect)){
+                candidates.append(page_index);
+            }
+        }
+        int center = keep_rect.center().y();
+        auto distance = [&](int page_index){
+            const QRect& bounds = m_pages[page_index].bounds;
+            return std::max(bounds.top()-center,center-bounds.bottom());
+        };
+        std::sort(candidates.begin(),candidates.end(),[&](int left,int right){
+            int left_distance = distance(left);
+            int right_distance = distance(right);
+            if(left_distance!=right_distance){
+                return left_distance>right_distance;
+            }
+            return m_pages[left].last_used<m_pages[right].last_used;
+        });
+
+        qint64 freed = 0;
+        for(bool compact:{true,false}){
+            for(int page_index:candidates){
+                if(freed>=bytes){
+                    return freed;
+                }
+                LayoutPage& page = m_pages[page_index];
+                qint64 page_usage = pageMemoryUsage(page);
+                if(compact){
+                    if(!page.resident){
+                        continue;
+                    }
+                    compactPage(page);
+                }else{
+                    discardPage(page);
+                }
+                freed += page_usage-pageMemoryUsage(page);
+            }
+        }
+        return freed;
+    }
+
+    void enforceMemoryBudget(){
+        if(m_memory_budget.limit()>0){
+            m_memory_budget.enforce(visibleRect());
+        }
+    }
+
+    LayoutPage& residentPage(int page_index){
+        LayoutPage& page = m_pages[page_index];
+        if(!page.resident){
+            page.compact_rects = QByteArray();
+            QList<double> column_total_heights = page.column_heights;
+            int end_index = std::min((page_index+1)*m_page_size,m_dirty_index);
+            computeItems(m_layout_rect,page_index*m_page_size,end_index,column_total_heights,true);
+        }
+        return m_pages[page_index];
+    }
+
+    // Visible part of the parent, in placement coordinates.
+    QRect visibleRect() const{
+        QWidget* widget = parentWidget();
+        if(widget==nullptr){
+            return geometry().translated(-m_layout_offset);
+        }
+        QRect visible_rect = widget->rect();
+        QPoint offset(0,0);
+        for(QWidget* child=widget;!child->isWindow() && child->parentWidget()!=nullptr;child=child->parentWidget()){
+            offset += child->pos();
+            visible_rect &= child->parentWidget()->rect().translated(-offset);
+        }
+        return visible_rect.translated(-m_layout_offset);
+    }
+
+    bool isBeyondFold(const QList<double>& column_total_heights,int fold_bottom) const{
+        int top = m_layout_margins.top();
+        for(double column_total_height:column_total_heights){
+            if(top+column_total_height<=fold_bottom){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    QList<double> columnHeightsBefore(int item_index){
+        if(item_index<=0){
+            if(m_column_base_heights.length()==m_column_count.value_or(0)){
+                return m_column_base_heights;
+            }
+            return QList<double>(m_column_count.value_or(0),0);
+        }
+        int page_index = (item_index-1)/m_page_size;
+        const LayoutPage& page = residentPage(page_index);
+        QList<double> column_total_heights = page.column_heights;
+        for(int offset=0;offset<item_index-page_index*m_page_size;++offset){
+            column_total_heights[page.columns[offset]] += page.extents[offset];
+        }
+        return column_total_heights;
+    }
+
+    void calculateColumnCount(const QRect& rect){
+        QMargins margin = contentsMargins();
+        int content_width = rect.width()-margin.left()-margin.right();
+        m_column_count = QMasonryPlacement::columnCount(content_width,m_column_width.value_or(0),m_horizontal_spacing);
+
+        m_static_layout = -1;
+        if(m_horizontal_adaption!=Zoom || m_board_page_height>0){
+            return;
+        }
+        for(int layout_index=0;layout_index<m_static_layouts.length();++layout_index){
+            const StaticLayout& layout = m_static_layouts[layout_index];
+            if(layout.content_width==content_width && layout.column_count==m_column_count.value_or(0)
+               && layout.horizontal_spacing==m_horizontal_spacing && layout.vertical_spacing==m_vertical_spacing
+               && layout.vertical_expansion==m_vertical_expansion
+               && (!isRandomExpansion() || (layout.random_choices==m_random_choices && layout.random_seed==m_random_seed))){
+                m_static_layout = layout_index;
+                break;
+            }
+        }
+    }
+
+    // Decides from the size hint alone, not from the widget's current width,
+    // so recomputing a committed item gives the size it was committed with.
+    QSize handleOverflow(const QSize& size_hint){
+        int item_height = size_hint.height();
+        int item_width = size_hint.width();
+
+        QSize fixed_size;
+        if(item_width!=columnWidth()){
+            switch (m_overflow)
+            {
+                case AutoZoom: {
+                    int column_height = item_height * columnWidth() / item_width;
+                    fixed_size = QSize(columnWidth(), column_height);
+                    break;
+                }
+                case AutoCrop:{
+                    fixed_size = QSize(columnWidth(), -1);
+                    break;
+                }
+                case Ignore:{
+                    break;
+                }
+                default:{
+                    throw std::runtime_error("Invalid overflow strategy");
+                }
+            }
+        }
+        return fixed_size;
+    }
+
+    int handleColumnSelection(int item_index,const QList<double>& column_total_heights){
+        if(m_degraded){
+            return degradedColumn(item_index);
+        }
+        int target_column_index = 0;
+        switch (m_vertical_expansion) {
+            case HeightBalance:
+            case OrderInsert:
+            case RandomInsert:
+            case ChoiceInsert:{
+                target_column_index = QMasonryPlacement::selectColumn(m_vertical_expansion,feedIndex(item_index),
+                                                                      column_total_heights,m_column_count.value_or(0),
+                                                                      m_random_choices,m_random_seed);
+                break;
+            }
+            default:{
+                throw std::runtime_error("Invalid vertical expansion strategy");
+            }
+        }
+        return target_column_index;
+    }
+
+    // Position of the item in the whole feed, so that random draws and
+    // round-robin don't shift when the front of the feed is evicted.
+    int feedIndex(int item_index) const{
+        return int((m_evicted_count+item_index)%0x40000000);
+    }
+
+    int degradedColumn(int item_index) const{
+        int column_count = m_column_count.value_or(0);
+        int previous_column_index = m_item_columns[item_index];
+        if(m_committed_column_count==column_count && previous_column_index>=0 && previous_column_index<column_count){
+            return previous_column_index;
+        }
+        return int(feedIndex(item_index)%column_count);
+    }
+
+    // NoAdaption and Spacing center the widget at its size hint in the
+    // column. Zoom fills the column: the same rect as
+    // QMasonryPlacement::zoomRun() and zoomRects(), so every strategy,
+    // degraded selection and static tables place a tile identically.
+    void handlePosition(const QRect&rect,
+                        int target_column_index,QList<double>& column_total_heights,
+                        const QSize& size_hint,double item_ratio,
+                        QRect& out_rect,QSize& out_fixed_size){
+        const QMargins& margin = m_layout_margins;
+        int space_x = m_horizontal_spacing;
+        int space_y = m_vertical_spacing;
+        int column_top = int(margin.top()+column_total_heights[target_column_index]);
+
+        auto getItemLeft = [&](double column_width,int item_width){
+            return QMasonryPlacement::itemLeft(margin.left(),column_width,target_column_index,space_x,item_width);
+        };
+
+        auto getRealColumnWidth = [&](int column_index){
+            return QMasonryPlacement::realColumnWidth(m_layout_content_width,m_column_count.value_or(0),space_x);
+        };
+
+        switch (m_horizontal_adaption) {
+            case NoAdaption:
+            case Spacing:{
+                double column_width = m_horizontal_adaption==NoAdaption ? columnWidth() : getRealColumnWidth(target_column_index);
+                out_rect.setRect(getItemLeft(column_width,size_hint.width()),column_top,size_hint.width(),size_hint.height());
+                column_total_heights[target_column_index] += size_hint.height()+space_y;
+                break;
+            }
+            case Zoom:{
+                int real_column_width = getRealColumnWidth(target_column_index);
+                double column_height = real_column_width*item_ratio;
+                out_rect.setRect(margin.left()+(real_column_width+space_x)*target_column_index,column_top,
+                                 real_column_width,int(column_height));
+                out_fixed_size = out_rect.size();
+                column_total_heights[target_column_index] += column_height+space_y;
+                break;
+            }
+            default:{
+                throw std::runtime_error("Invalid horizontal adaptation strategy");
+            }
+        }
+    }
+
+    // The tile's own size hint. QWidgetItem::sizeHint() is bounded by the
+    // fixed size a commit sets, so it would no longer match the hint the
+    // tile was placed from.
+    QSize itemSizeHint(int item_index) const{
+        QLayoutItem*item = m_items[item_index];
+        if(auto masonry_item = dynamic_cast<QMasonryWidgetItem*>(item)){
+            return masonry_item->widgetSizeHint();
+        }
+        QWidget*item_widget = item->widget();
+        return item_widget!=nullptr ? item_widget->sizeHint() : item->sizeHint();
+    }
+
+    // A recompute rebuilds a discarded page of committed items from what was
+    // recorded when they were placed, the size hints and columns, so it gives
+    // back the committed geometry whatever the widgets report now.
+    void computeItem(const QRect& rect,int item_index,QList<double>& column_total_heights,bool recompute){
+        LayoutPage& page = pageFor(item_index);
+        int offset = item_index%m_page_size;
+        if(offset==0){
+            page.column_heights = column_total_heights;
+            page.bounds = QRect();
+        }
+
+        if(m_static_layout>=0 && m_evicted_count==0 && item_index<m_static_layouts[m_static_layout].rect_count){
+            applyStaticRect(item_index,page,column_total_heights);
+            return;
+        }
+
+        QSize size_hint;
+        QSize fixed_size;
+        if(m_horizontal_adaption!=Zoom){
+            size_hint = recompute ? m_item_size_hints[item_index] : itemSizeHint(item_index);
+            fixed_size = handleOverflow(size_hint);
+        }
+
+        double item_ratio = itemRatios()[item_index];
+        int target_column_index = recompute ? m_item_columns[item_index]
+                                            : handleColumnSelection(item_index,column_total_heights);
+        double column_height = column_total_heights[target_column_index];
+        handlePosition(rect,
+                       target_column_index,column_total_heights,
+                       size_hint,item_ratio,
+                       page.rects[offset],fixed_size);
+        if(m_board_page_height>0){
+            breakBoardPage(page.rects[offset],fixed_size,column_total_heights[target_column_index]);
+        }
+
+        page.fixed_sizes[offset] = fixed_size;
+        page.columns[offset] = target_column_index;
+        page.extents[offset] = column_total_heights[target_column_index]-column_height;
+        page.bounds |= page.rects[offset];
+        page.resident = true;
+        page.last_used = m_page_clock;
+        if(!recompute){
+            m_item_size_hints[item_index] = size_hint;
+        }
+    }
+
+    // Zoom runs need no widget to place an item, and with OrderInsert or
+    // degraded selection the columns don't depend on the heights, so a page
+    // can be laid out by QMasonryPlacement::zoomRun() in one go.
+    bool isZoomRunnable() const{
+        return m_horizontal_adaption==Zoom && m_static_layout<0 && m_board_page_height==0
+               && (m_degraded || m_vertical_expansion==OrderInsert);
+    }
+
+    void computeZoomRun(const QRect& rect,int first_index,int end_index,QList<double>& column_total_heights,bool recompute){
+        const QMargins& margin = m_layout_margins;
+        LayoutPage& page = pageFor(end_index-1);
+        int first_offset = first_index%m_page_size;
+        if(first_offset==0){
+            page.column_heights = column_total_heights;
+            page.bounds = QRect();
+        }
+        for(int item_index=first_index;item_index<end_index;++item_index){
+            page.columns[item_index%m_page_size] = recompute ? m_item_columns[item_index]
+                                                             : handleColumnSelection(item_index,column_total_heights);
+        }
+        int column_width = QMasonryPlacement::realColumnWidth(m_layout_content_width,m_column_count.value_or(0),m_horizontal_spacing);
+        QMasonryPlacement::zoomRun(itemRatios().constData()+first_index,page.columns.constData()+first_offset,
+                                   end_index-first_index,margin.left(),margin.top(),
+                                   column_width,m_horizontal_spacing,m_vertical_spacing,
+                                   column_total_heights.data(),page.rects.data()+first_offset,page.extents.data()+first_offset);
+        for(int item_index=first_index;item_index<end_index;++item_index){
+            int offset = item_index%m_page_size;
+            page.fixed_sizes[offset] = page.rects[offset].size();
+            page.bounds |= page.rects[offset];
+        }
+        page.resident = true;
+        page.last_used = m_page_clock;
+    }
+
+    void computeItems(const QRect& rect,int first_index,int end_index,QList<double>& column_total_heights,bool recompute = false){
+        bool zoom_run = isZoomRunnable();
+        for(int item_index=first_index;item_index<end_index;){
+            if(!zoom_run){
+                computeItem(rect,item_index,column_total_heights,recompute);
+                ++item_index;
+                continue;
+            }
+            int run_end = std::min(end_index,(item_index/m_page_size+1)*m_page_size);
+            computeZoomRun(rect,item_index,run_end,column_total_heights,recompute);
+            item_index = run_end;
+        }
+    }
+
+    void applyStaticRect(int item_index,LayoutPage& page,QList<double>& column_total_heights){
+        const QMargins& margin = m_layout_margins;
+        int offset = item_index%m_page_size;
+        QRect static_rect = m_static_layouts[m_static_layout].rects[item_index];
+        int column_width = static_rect.width();
+        int column_index = static_rect.x()/(column_width+m_horizontal_spacing);
+        double extent = column_width*itemRatios()[item_index]+m_vertical_spacing;
+
+        page.rects[offset] = static_rect.translated(margin.left(),margin.top());
+        page.fixed_sizes[offset] = static_rect.size();
+        page.columns[offset] = column_index;
+        page.extents[offset] = extent;
+        page.bounds |= page.rects[offset];
+        page.resident = true;
+        column_total_heights[column_index] += extent;
+    }
+
+    int boardPageOf(const QRect& item_rect) const{
+        return std::max(0,item_rect.top()-m_layout_margins.top())/m_board_page_height;
+    }
+
+    // Moves an item that would cross a page break to the top of the next
+    // page, growing its column by the skipped space. Items taller than a
+    // page start at a page top and are cut off at its bottom.
+    void breakBoardPage(QRect& item_rect,const QSize& fixed_size,double& column_total_height){
+        int top = item_rect.top()-m_layout_margins.top();
+        int height = fixed_size.height()>=0 ? fixed_size.height() : item_rect.height();
+        int page_top = std::max(0,top)/m_board_page_height*m_board_page_height;
+        if(top>page_top && top+height>page_top+m_board_page_height){
+            int skipped = page_top+m_board_page_height-top;
+            item_rect.translate(0,skipped);
+            column_total_height += skipped;
+        }
+    }
+
+    // Board page items are kept in item order, so dropping the items from
+    // first_index on only pops the tails of the lists.
+    void truncateBoardPages(int first_index){
+        for(QList<int>& board_page_items:m_board_page_items){
+            while(!board_page_items.isEmpty() && board_page_items.last()>=first_index){
+                board_page_items.removeLast();
+            }
+        }
+        while(!m_board_page_items.isEmpty() && m_board_page_items.last().isEmpty()){
+            m_board_page_items.removeLast();
+        }
+    }
+
+    void commitItem(int item_index){
+        QLayoutItem*item = m_items[item_index];
+        QWidget*item_widget = item->widget();
+        const LayoutPage& page = m_pages[item_index/m_page_size];
+        QSize fixed_size = page.fixed_sizes[item_index%m_page_size];
+        if(item_widget!=nullptr && fixed_size.width()>=0){
+            if(fixed_size.height()>=0){
+                item_widget->setFixedSize(fixed_size);
+            }else{
+                item_widget->setFixedWidth(fixed_size.width());
+            }
+        }
+        item->setGeometry(displayRect(page.rects[item_index%m_page_size]));
+        m_item_placed[item_index] = true;
+        m_item_columns[item_index] = page.columns[item_index%m_page_size];
+    }
+
+    int commitItems(){
+        int committed_count = m_dirty_index-m_committed_index;
+        if(m_board_page_height>0){
+            truncateBoardPages(m_committed_index);
+        }
+        for(int item_index=m_committed_index;item_index<m_dirty_index;++item_index){
+            commitItem(item_index);
+            if(m_board_page_height>0){
+                int board_page = boardPageOf(m_pages[item_index/m_page_size].rects[item_index%m_page_size]);
+                if(m_board_page_items.length()<=board_page){
+                    m_board_page_items.resize(board_page+1);
+                }
+                m_board_page_items[board_page].append(item_index);
+            }
+        }
+        m_impression_first_index = std::min(m_impression_first_index,m_committed_index);
+        m_committed_index = m_dirty_index;
+        m_committed_column_count = m_column_count.value_or(0);
+        return committed_count;
+    }
+
+    void beginPass(QElapsedTimer& timer){
+        ++m_page_clock;
+        timer.start();
+        if(m_perf_counters!=nullptr){
+            m_perf_counters->start();
+        }
+    }
+
+    void endPass(const QElapsedTimer& timer,int computed_count,int committed_count){
+        m_stats.nsecs += timer.nsecsElapsed();
+        ++m_stats.passes;
+        if(m_degraded){
+            ++m_stats.degraded_passes;
+        }
+        m_stats.computed_items += computed_count;
+        m_stats.committed_items += committed_count;
+        if(m_perf_counters==nullptr){
+            return;
+        }
+        m_perf_counters->stop();
+        for(int counter=0;counter<QMasonryPerfCounters::CounterCount;++counter){
+            qint64 value = m_perf_counters->value(QMasonryPerfCounters::Counter(counter));
+            if(value>=0){
+                m_stats.counters[counter] = std::max<qint64>(m_stats.counters[counter],0)+value;
+            }
+        }
+    }
+
+    // Runs from the event loop: finishes a lazy placement in chunks, or
+    // precomputes the geometry of a hidden layout for its last known width
+    // without touching any widget until it is shown. Setters may have
+    // changed the column count since the last pass, so it is worked out
+    // again first.
+    void continuePlacement(){
+        if(!m_layout_rect.isValid()){
+            return;
+        }
+        QElapsedTimer timer;
+        beginPass(timer);
+
+        calculateColumnCount(m_layout_rect);
+        int first_index = updateDirtyIndex(m_layout_rect);
+        int item_index = first_index;
+        QList<double> column_total_heights = columnHeightsBefore(item_index);
+        while(item_index<m_items.length() && !timer.hasExpired(m_placement_chunk_msecs)){
+            computeItem(m_layout_rect,item_index,column_total_heights,false);
+            ++item_index;
+        }
+        m_dirty_index = item_index;
+        int committed_count = isDeferred() ? 0 : commitItems();
+        endPass(timer,item_index-first_index,committed_count);
+        evictFeedItems();
+        updateImpressions();
+        enforceMemoryBudget();
+        if(isPlacementPending()){
+            m_placement_timer->start();
+        }
+    }
+
+    // Deletes the leading pages lying entirely above the feed window and
+    // moves the rest up. Returns the shift.
+    int evictFeedItems(){
+        if(m_feed_window<0 || isDeferred()){
+            return 0;
+        }
+        int fold_top = visibleRect().top()-m_feed_window;
+        int page_count = 0;
+        while((page_count+1)*m_page_size<m_committed_index && m_pages[page_count].bounds.bottom()<fold_top){
+            ++page_count;
+        }
+        if(page_count==0){
+            return 0;
+        }
+
+        int evicted_count = page_count*m_page_size;
+        detachItemStore();
+        for(int item_index=0;item_index<evicted_count;++item_index){
+            QLayoutItem*item = m_items[item_index];
+            if(QWidget*widget = item->widget()){
+                widget->hide();
+                widget->deleteLater();
+            }
+            delete item;
+        }
+        m_items.remove(0,evicted_count);
+        m_item_ratios.remove(0,evicted_count);
+        m_item_keys.remove(0,evicted_count);
+        m_item_size_hints.remove(0,evicted_count);
+        m_item_placed.remove(0,evicted_count);
+        m_item_columns.remove(0,evicted_count);
+        m_pages.remove(0,page_count);
+        m_widget_indexes_stale = true;
+
+        // Heights stay whole pixels so HeightBalance compares them as before.
+        const QList<double>& base_heights = m_pages.first().column_heights;
+        int shift = qFloor(*std::min_element(base_heights.begin(),base_heights.end()));
+        for(LayoutPage& page:m_pages){
+            for(double& column_height:page.column_heights){
+                column_height -= shift;
+            }
+            for(QRect& rect:page.rects){
+                rect.translate(0,-shift);
+            }
+            page.bounds.translate(0,-shift);
+            page.compact_rects = QByteArray();
+        }
+        m_column_base_heights = m_pages.first().column_heights;
+        m_evicted_count += evicted_count;
+        if(m_impression_tracker!=nullptr){
+            m_impression_tracker->removeFirst(evicted_count);
+        }
+        m_dirty_index -= evicted_count;
+
+        // Every remaining widget moved, so all of them are committed again.
+        for(int page_index=0;page_index*m_page_size<m_dirty_index;++page_index){
+            residentPage(page_index);
+        }
+        m_committed_index = 0;
+        commitItems();
+        emit itemsEvicted(evicted_count,shift);
+        return shift;
+    }
+
+    QSize layoutSize(const QRect& rect,const QList<double>& column_total_heights) const{
+        if(column_total_heights.isEmpty()){
+            return QSize(rect.width(),0);
+        }
+        return QSize(rect.width(),*std::max_element(column_total_heights.begin(),column_total_heights.end()));
+    }
+
+    // Called after a pass: an over-budget resize starts degraded mode, and
+    // every pass while degraded pushes the restore back.
+    void updateDegradation(const QElapsedTimer& timer,bool resized){
+        if(m_latency_budget_msecs<=0){
+            return;
+        }
+        if(!m_degraded && resized && timer.hasExpired(m_latency_budget_msecs)){
+            m_degraded = true;
+        }
+        if(m_degraded){
+            m_degraded_timer->start(m_degraded_settle_msecs);
+        }
+    }
+
+    void restoreExpansion(){
+        m_degraded_timer->stop();
+        if(!m_degraded){
+            return;
+        }
+        m_degraded = false;
+        markDirty(0);
+        if(!isDeferred() && m_layout_rect.isValid()){
+            doLayout(m_layout_rect);
+        }
+    }
+
+    // The rect a pass lays out at: a width inside the settled range is
+    // replaced by the settled width, and suppressed is set when that
+    // discards a width change.
+    QRect settledRect(QRect rect,bool& suppressed){
+        suppressed = false;
+        int width = rect.width();
+        if(m_settled_width>0){
+            if(width>=m_settled_width && width<=m_settled_width+m_settled_band){
+                suppressed = width!=m_settled_width;
+                rect.setWidth(m_settled_width);
+                return rect;
+            }
+            m_settled_width = 0;
+        }
+        int layout_width = m_layout_rect.width();
+        if(!m_layout_rect.isValid() || width==layout_width){
+            return rect;
+        }
+        bool oscillating = m_oscillation_window_msecs>0 && width==m_previous_layout_width
+                           && m_width_change_timer.isValid()
+                           && !m_width_change_timer.hasExpired(m_oscillation_window_msecs);
+        m_previous_layout_width = layout_width;
+        m_width_change_timer.start();
+        if(oscillating){
+            m_settled_width = std::min(width,layout_width);
+            m_settled_band = qAbs(width-layout_width);
+            if(width>m_settled_width){
+                suppressed = true;
+                rect.setWidth(m_settled_width);
+            }
+        }
+        return rect;
+    }
+
+    QSize doLayout(const QRect& layout_rect){
+        QElapsedTimer timer;
+        beginPass(timer);
+        bool suppressed;
+        QRect rect = settledRect(layout_rect,suppressed);
+        if(suppressed){
+            ++m_stats.suppressed_passes;
+        }
+        bool resized = m_layout_rect.isValid() && rect.width()!=m_layout_rect.width();
+
+        calculateColumnCount(rect);
+        int first_index = updateDirtyIndex(rect);
+        int item_index = first_index;
+        int committed_count = 0;
+        QList<double> column_total_heights = columnHeightsBefore(item_index);
+
+        if(!isDeferred()){
+            if(m_lazy_placement){
+                int fold_bottom = visibleRect().bottom()+m_lazy_placement_margin;
+                for(;item_index<m_items.size();++item_index){
+                    if(!m_item_placed[item_index] && isBeyondFold(column_total_heights,fold_bottom)){
+                        break;
+                    }
+                    computeItem(rect,item_index,column_total_heights,false);
+                }
+            }else{
+                computeItems(rect,item_index,m_items.size(),column_total_heights);
+                item_index = m_items.size();
+            }
+            m_dirty_index = item_index;
+            if(m_committed_index<m_dirty_index){
+                engageRenderCache();
+            }
+            committed_count = commitItems();
+        }
+        endPass(timer,item_index-first_index,committed_count);
+        updateDegradation(timer,resized);
+        updateTargetWidth();
+        int shift = evictFeedItems();
+        for(double& column_total_height:column_total_heights){
+            column_total_height -= shift;
+        }
+        updateImpressions();
+        enforceMemoryBudget();
+        if(isPlacementPending()){
+            m_placement_timer->start();
         }
-        return QSize(rect.width(),*std::max(column_total_heights.begin(),column_total_heights.end()));
+        return layoutSize(rect,column_total_heights);
     }
 };
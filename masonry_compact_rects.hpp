@@ -0,0 +1,99 @@
+#pragma once
+#include <QByteArray>
+#include <QList>
+#include <QRect>
+#include <QtGlobal>
+
+// Packs the rects of a run of items into one varint stream per column. Inside
+// a column every rect is stored relative to the one above it (gap to its
+// bottom, x and width deltas), which stay at a byte each when tiles share a
+// column width.
+class QMasonryCompactRects
+{
+public:
+    static QByteArray encode(const QList<QRect>& rects,const QList<int>& columns,int column_count){
+        QList<QByteArray> streams(column_count);
+        QList<int> last_indexes(column_count,-1);
+        QList<QRect> last_rects(column_count,QRect(0,0,0,0));
+        for(int index=0;index<rects.length();++index){
+            int column_index = columns[index];
+            const QRect& rect = rects[index];
+            const QRect& last_rect = last_rects[column_index];
+            QByteArray& stream = streams[column_index];
+            writeVarint(stream,index-last_indexes[column_index]-1);
+            writeVarint(stream,zigzag(rect.y()-last_rect.y()-last_rect.height()));
+            writeVarint(stream,zigzag(rect.x()-last_rect.x()));
+            writeVarint(stream,zigzag(rect.width()-last_rect.width()));
+            writeVarint(stream,zigzag(rect.height()));
+            last_indexes[column_index] = index;
+            last_rects[column_index] = rect;
+        }
+
+        QByteArray data;
+        writeVarint(data,rects.length());
+        writeVarint(data,column_count);
+        for(const QByteArray& stream:streams){
+            writeVarint(data,stream.size());
+        }
+        for(const QByteArray& stream:streams){
+            data.append(stream);
+        }
+        return data;
+    }
+
+    static QList<QRect> decode(const QByteArray& data){
+        const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+        qsizetype position = 0;
+        int item_count = readVarint(bytes,position);
+        int column_count = readVarint(bytes,position);
+        QList<qsizetype> stream_ends(column_count);
+        for(int column_index=0;column_index<column_count;++column_index){
+            stream_ends[column_index] = readVarint(bytes,position);
+        }
+        for(int column_index=0;column_index<column_count;++column_index){
+            stream_ends[column_index] += column_index==0 ? position : stream_ends[column_index-1];
+        }
+
+        QList<QRect> rects(item_count);
+        for(int column_index=0;column_index<column_count;++column_index){
+            int index = -1;
+            int x = 0,y = 0,width = 0,height = 0;
+            while(position<stream_ends[column_index]){
+                index += readVarint(bytes,position)+1;
+                y += height+unzigzag(readVarint(bytes,position));
+                x += unzigzag(readVarint(bytes,position));
+                width += unzigzag(readVarint(bytes,position));
+                height = unzigzag(readVarint(bytes,position));
+                rects[index] = QRect(x,y,width,height);
+            }
+        }
+        return rects;
+    }
+private:
+    static quint32 zigzag(int value){
+        return (quint32(value)<<1)^quint32(value>>31);
+    }
+
+    static int unzigzag(quint32 value){
+        return int(value>>1)^-int(value&1);
+    }
+
+    static void writeVarint(QByteArray& data,quint32 value){
+        while(value>=0x80){
+            data.append(char(value|0x80));
+            value >>= 7;
+        }
+        data.append(char(value));
+    }
+
+    static quint32 readVarint(const uchar* bytes,qsizetype& position){
+        quint32 value = 0;
+        int shift = 0;
+        while(bytes[position]&0x80){
+            value |= quint32(bytes[position++]&0x7f)<<shift;
+            shift += 7;
+        }
+        value |= quint32(bytes[position++])<<shift;
+        return value;
+    }
+};
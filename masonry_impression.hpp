@@ -0,0 +1,267 @@
+#pragma once
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QRect>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <algorithm>
+
+// Tracks which tiles are visible in a viewport, and by how much, from their
+// rects alone. Tiles are kept per column top to bottom, so moving the
+// viewport only looks at the tiles along its edges: the ones whose coverage
+// can change. A tile is impressed once it has stayed at least threshold
+// covered for the dwell time, and again only after it dropped below it.
+class QMasonryImpressionTracker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QMasonryImpressionTracker(QObject *parent = nullptr): QObject(parent){
+        m_clock.start();
+        m_dwell_timer = new QTimer(this);
+        m_dwell_timer->setSingleShot(true);
+        connect(m_dwell_timer,&QTimer::timeout,this,[this](){
+            reportImpressions();
+        });
+    }
+
+    // Fraction of a tile, in (0, 1], that counts towards an impression.
+    void setThreshold(double coverage){
+        m_threshold = std::clamp(coverage,0.01,1.0);
+    }
+    double threshold() const{
+        return m_threshold;
+    }
+
+    void setDwellTime(int msecs){
+        m_dwell_msecs = std::max(0,msecs);
+    }
+    int dwellTime() const{
+        return m_dwell_msecs;
+    }
+
+    // Replaces the tile rects, then checks the tiles that were visible and
+    // the ones now in the viewport.
+    void setItemRects(const QList<QRect>& rects){
+        setItemRects(0,rects);
+    }
+
+    // Replaces the rects from first_index on, keeping the ones before it, so
+    // that a layout appending tiles only hands over the new ones. Tiles are
+    // expected in placement order: each one below the tiles before it that
+    // share its x, which keeps every column sorted by only appending to it.
+    void setItemRects(int first_index,const QList<QRect>& rects){
+        first_index = std::clamp<int>(first_index,0,m_rects.length());
+        if(first_index==0){
+            m_column_of.clear();
+            m_column_items.clear();
+        }
+        for(QList<int>& column_items:m_column_items){
+            while(!column_items.isEmpty() && column_items.last()>=first_index){
+                column_items.removeLast();
+            }
+        }
+        m_rects.resize(first_index);
+        m_rects.append(rects);
+        for(int index=first_index;index<m_rects.length();++index){
+            auto column = m_column_of.find(m_rects[index].x());
+            if(column==m_column_of.end()){
+                column = m_column_of.insert(m_rects[index].x(),m_column_items.length());
+                m_column_items.append(QList<int>());
+            }
+            m_column_items[*column].append(index);
+        }
+        QList<int> indexes = m_visible.keys();
+        for(int index:indexes){
+            if(index>=first_index){
+                updateItem(index);
+            }
+        }
+        visitItems(m_viewport,QRect(),[this](int index){
+            updateItem(index);
+        });
+    }
+
+    int itemCount() const{
+        return m_rects.length();
+    }
+
+    // Moves the viewport. Only tiles that are in the old or the new viewport
+    // but not inside both are checked.
+    void setViewport(const QRect& viewport){
+        if(viewport==m_viewport){
+            return;
+        }
+        QRect last_viewport = m_viewport;
+        m_viewport = viewport;
+        auto update_item = [this](int index){
+            updateItem(index);
+        };
+        if(!viewport.intersects(last_viewport)){
+            visitItems(last_viewport,QRect(),update_item);
+            visitItems(viewport,QRect(),update_item);
+            return;
+        }
+        QRect unchanged;
+        if(viewport.left()==last_viewport.left() && viewport.right()==last_viewport.right()){
+            unchanged = viewport & last_viewport;
+        }
+        visitItems(viewport | last_viewport,unchanged,update_item);
+    }
+    QRect viewport() const{
+        return m_viewport;
+    }
+
+    // Drops the first count tiles, e.g. after a feed evicted them, so that
+    // the remaining ones keep their visibility under their new indexes.
+    void removeFirst(int count){
+        if(count<=0){
+            return;
+        }
+        QHash<int,Visibility> visible;
+        for(auto it=m_visible.begin();it!=m_visible.end();++it){
+            if(it.key()<count){
+                emit itemExited(it.key());
+            }else{
+                visible.insert(it.key()-count,it.value());
+            }
+        }
+        m_visible = visible;
+        m_rects = m_rects.mid(std::min<int>(count,m_rects.length()));
+        for(QList<int>& column_items:m_column_items){
+            column_items.erase(std::remove_if(column_items.begin(),column_items.end(),[count](int index){
+                return index<count;
+            }),column_items.end());
+            for(int& index:column_items){
+                index -= count;
+            }
+        }
+    }
+
+    // Visible fraction of the tile at index, 0 when it is not visible.
+    double coverage(int index) const{
+        return m_visible.value(index).coverage;
+    }
+
+    QList<int> visibleItems() const{
+        QList<int> indexes = m_visible.keys();
+        std::sort(indexes.begin(),indexes.end());
+        return indexes;
+    }
+signals:
+    void itemEntered(int index,double coverage);
+    void itemCoverageChanged(int index,double coverage);
+    void itemExited(int index);
+
+    // Emitted once a tile has been at least threshold() covered for
+    // dwellTime().
+    void itemImpressed(int index);
+private:
+    struct Visibility
+    {
+        double coverage = 0;
+        qint64 covered_since = -1;
+        bool impressed = false;
+    };
+
+    QList<QRect> m_rects;
+    QHash<int,int> m_column_of;
+    QList<QList<int>> m_column_items;
+    QRect m_viewport;
+    QHash<int,Visibility> m_visible;
+
+    double m_threshold = 0.5;
+    int m_dwell_msecs = 1000;
+    QElapsedTimer m_clock;
+    QTimer* m_dwell_timer = nullptr;
+
+    // Calls visit for the tiles intersecting rect, skipping the run of each
+    // column that lies within unchanged.
+    template<typename Visit>
+    void visitItems(const QRect& rect,const QRect& unchanged,Visit visit) const{
+        if(rect.isEmpty()){
+            return;
+        }
+        for(const QList<int>& column_items:m_column_items){
+            auto it = std::lower_bound(column_items.begin(),column_items.end(),rect.top(),[this](int index,int top){
+                return m_rects[index].bottom()<top;
+            });
+            while(it!=column_items.end() && m_rects[*it].top()<=rect.bottom()){
+                const QRect& item_rect = m_rects[*it];
+                if(!unchanged.isEmpty() && item_rect.top()>=unchanged.top() && item_rect.bottom()<=unchanged.bottom()){
+                    it = std::upper_bound(it,column_items.end(),unchanged.bottom(),[this](int bottom,int index){
+                        return bottom<m_rects[index].bottom();
+                    });
+                    continue;
+                }
+                if(item_rect.intersects(rect)){
+                    visit(*it);
+                }
+                ++it;
+            }
+        }
+    }
+
+    void updateItem(int index){
+        double coverage = 0;
+        if(index<m_rects.length() && !m_rects[index].isEmpty()){
+            QRect visible_rect = m_rects[index] & m_viewport;
+            coverage = double(visible_rect.width())*visible_rect.height()/(double(m_rects[index].width())*m_rects[index].height());
+        }
+        auto it = m_visible.find(index);
+        if(coverage<=0){
+            if(it!=m_visible.end()){
+                m_visible.erase(it);
+                emit itemExited(index);
+            }
+            return;
+        }
+        bool entered = it==m_visible.end();
+        if(entered){
+            it = m_visible.insert(index,Visibility());
+        }
+        Visibility& visibility = *it;
+        bool changed = visibility.coverage!=coverage;
+        visibility.coverage = coverage;
+        if(coverage<m_threshold){
+            visibility.covered_since = -1;
+            visibility.impressed = false;
+        }else if(visibility.covered_since<0 && !visibility.impressed){
+            visibility.covered_since = m_clock.elapsed();
+            if(!m_dwell_timer->isActive()){
+                m_dwell_timer->start(m_dwell_msecs);
+            }
+        }
+        if(entered){
+            emit itemEntered(index,coverage);
+        }else if(changed){
+            emit itemCoverageChanged(index,coverage);
+        }
+    }
+
+    void reportImpressions(){
+        qint64 now = m_clock.elapsed();
+        qint64 next_due = -1;
+        QList<int> impressed;
+        for(auto it=m_visible.begin();it!=m_visible.end();++it){
+            Visibility& visibility = it.value();
+            if(visibility.covered_since<0 || visibility.impressed){
+                continue;
+            }
+            qint64 due = visibility.covered_since+m_dwell_msecs;
+            if(due<=now){
+                visibility.impressed = true;
+                impressed.append(it.key());
+            }else if(next_due<0 || due<next_due){
+                next_due = due;
+            }
+        }
+        if(next_due>=0){
+            m_dwell_timer->start(int(next_due-now));
+        }
+        std::sort(impressed.begin(),impressed.end());
+        for(int index:impressed){
+            emit itemImpressed(index);
+        }
+    }
+};
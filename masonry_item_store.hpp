@@ -0,0 +1,89 @@
+#pragma once
+#include <QObject>
+#include <QList>
+#include <QSize>
+#include <QString>
+
+// Keys and natural sizes of a board's items, shared by every
+// QMasonryFlowLayout showing that board. Ratios are worked out once here and
+// read in place by the layouts, which keep only their own widgets and
+// per-width geometry.
+class QMasonryItemStore : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QMasonryItemStore(QObject *parent = nullptr): QObject(parent){}
+
+    int count() const{
+        return m_keys.length();
+    }
+
+    QString key(int index) const{
+        return m_keys.value(index);
+    }
+    QSize size(int index) const{
+        return m_sizes.value(index);
+    }
+    double ratio(int index) const{
+        return m_ratios.value(index);
+    }
+
+    const QList<QString>& keys() const{
+        return m_keys;
+    }
+    const QList<double>& ratios() const{
+        return m_ratios;
+    }
+
+    void append(const QString& key,const QSize& size){
+        append(QList<QString>{key},QList<QSize>{size});
+    }
+
+    void append(const QList<QString>& keys,const QList<QSize>& sizes){
+        if(keys.isEmpty()){
+            return;
+        }
+        int first_index = m_keys.length();
+        for(int index=0;index<keys.length();++index){
+            QSize size = sizes.value(index);
+            m_keys.append(keys[index]);
+            m_sizes.append(size);
+            m_ratios.append(ratioOf(size));
+        }
+        emit itemsAppended(first_index,keys.length());
+    }
+
+    void setSize(int index,const QSize& size){
+        if(index<0 || index>=m_keys.length()){
+            return;
+        }
+        m_sizes[index] = size;
+        m_ratios[index] = ratioOf(size);
+        emit itemChanged(index);
+    }
+
+    // Replaces every item; layouts keep the widgets of keys still present.
+    void setItems(const QList<QString>& keys,const QList<QSize>& sizes){
+        m_keys = keys;
+        m_sizes.clear();
+        m_ratios.clear();
+        for(int index=0;index<keys.length();++index){
+            QSize size = sizes.value(index);
+            m_sizes.append(size);
+            m_ratios.append(ratioOf(size));
+        }
+        emit itemsReset();
+    }
+signals:
+    void itemsAppended(int first,int count);
+    void itemChanged(int index);
+    void itemsReset();
+private:
+    static double ratioOf(const QSize& size){
+        return size.width()>0 ? double(size.height())/size.width() : 0;
+    }
+
+    QList<QString> m_keys;
+    QList<QSize> m_sizes;
+    QList<double> m_ratios;
+};
@@ -0,0 +1,121 @@
+#include <QCoreApplication>
+#include <QList>
+#include <QRect>
+#include <QTextStream>
+#include <random>
+#include "masonry_compact_rects.hpp"
+#include "masonry_impression.hpp"
+
+// Checks of the parts of the board that need QtCore only, run by ctest.
+// Every case prints what went wrong and the run fails if any did.
+
+static QTextStream err(stderr);
+
+// A layout page of 256 items over five columns, one of them left empty,
+// with irregular gaps, x and width changes and some empty rects, must come
+// back from QMasonryCompactRects exactly.
+static bool compactRoundTrip(){
+    std::mt19937 random(81);
+    const int column_count = 5;
+    QList<int> bottoms(column_count,0);
+    QList<QRect> rects;
+    QList<int> columns;
+    for(int index=0;index<256;++index){
+        int column_index = int(random()%(column_count-1));
+        int x = column_index*216+int(random()%3)-1;
+        int width = 200+int(random()%5)-2;
+        int height = index%37==0 ? 0 : 20+int(random()%400);
+        int y = bottoms[column_index]+int(random()%33)-8;
+        rects.append(QRect(x,y,width,height));
+        columns.append(column_index);
+        bottoms[column_index] = y+height;
+    }
+
+    QByteArray data = QMasonryCompactRects::encode(rects,columns,column_count);
+    QList<QRect> decoded = QMasonryCompactRects::decode(data);
+    if(decoded!=rects){
+        err<<"compact: 256 rects did not survive encode and decode\n";
+        return false;
+    }
+    if(QMasonryCompactRects::decode(QMasonryCompactRects::encode({},{},column_count))!=QList<QRect>()){
+        err<<"compact: an empty page did not survive encode and decode\n";
+        return false;
+    }
+    return true;
+}
+
+// The items a viewport intersects, found by looking at every rect.
+static QList<int> intersectingItems(const QList<QRect>& rects,const QRect& viewport,int first_index = 0){
+    QList<int> indexes;
+    for(int index=first_index;index<rects.length();++index){
+        if(rects[index].intersects(viewport)){
+            indexes.append(index-first_index);
+        }
+    }
+    return indexes;
+}
+
+// On 200 random three-column boards, a tracker given its rects in two
+// overlapping runs must agree with one given them at once and with a scan
+// of every rect, and after removeFirst() with a tracker built from the
+// remaining rects alone.
+static bool trackerMatchesFullScan(){
+    std::mt19937 random(100);
+    const int column_count = 3;
+    for(int board=0;board<200;++board){
+        int item_count = 50+int(random()%50);
+        QList<double> bottoms(column_count,0);
+        QList<QRect> rects;
+        for(int index=0;index<item_count;++index){
+            int column_index = int(random()%column_count);
+            int height = 10+int(random()%40);
+            rects.append(QRect(column_index*110,int(bottoms[column_index]),100,height));
+            bottoms[column_index] += height+5;
+        }
+
+        QMasonryImpressionTracker incremental;
+        QMasonryImpressionTracker full;
+        QRect viewport(0,int(random()%300),330,200);
+        incremental.setViewport(viewport);
+        full.setViewport(viewport);
+        int first_index = int(random()%item_count);
+        incremental.setItemRects(0,rects.mid(0,first_index+int(random()%(item_count-first_index))));
+        incremental.setItemRects(first_index,rects.mid(first_index));
+        full.setItemRects(rects);
+        QList<int> expected = intersectingItems(rects,viewport);
+        if(full.visibleItems()!=expected || incremental.visibleItems()!=expected){
+            err<<"tracker: board "<<board<<" sees other items than a full scan\n";
+            return false;
+        }
+        for(int index=0;index<item_count;++index){
+            if(incremental.coverage(index)!=full.coverage(index)){
+                err<<"tracker: board "<<board<<" item "<<index<<" has another coverage\n";
+                return false;
+            }
+        }
+
+        int cut = int(random()%item_count);
+        incremental.removeFirst(cut);
+        QRect moved_viewport(0,int(random()%600),330,150);
+        incremental.setViewport(moved_viewport);
+        QMasonryImpressionTracker remaining;
+        remaining.setViewport(moved_viewport);
+        remaining.setItemRects(rects.mid(cut));
+        if(incremental.itemCount()!=item_count-cut
+           || incremental.visibleItems()!=remaining.visibleItems()
+           || incremental.visibleItems()!=intersectingItems(rects,moved_viewport,cut)){
+            err<<"tracker: board "<<board<<" is wrong after removing "<<cut<<" items\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc,char** argv){
+    QCoreApplication application(argc,argv);
+    bool passed = true;
+    passed = compactRoundTrip() && passed;
+    passed = trackerMatchesFullScan() && passed;
+    err.flush();
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <QList>
+#include <QRect>
+#include <QtGlobal>
+#include <algorithm>
+
+enum MemoryTrimLevel{
+    TrimModerate,
+    TrimBackground,
+    TrimComplete,
+};
+
+// A cache that can give memory back to a QMasonryMemoryBudget.
+class QMasonryMemoryConsumer
+{
+public:
+    virtual ~QMasonryMemoryConsumer() = default;
+
+    virtual qint64 memoryUsage() const = 0;
+
+    // Frees up to bytes, never touching what lies in keep_rect (layout
+    // coordinates), and taking entries furthest from it and least recently
+    // used first. Returns the number of bytes actually freed.
+    virtual qint64 releaseMemory(qint64 bytes,const QRect& keep_rect) = 0;
+};
+
+// One limit shared by every cache registered with it. When the total goes
+// over the limit, each consumer is asked for a share of the excess in
+// proportion to its usage, then the rest is taken from whoever still can.
+class QMasonryMemoryBudget
+{
+public:
+    void setLimit(qint64 bytes){
+        m_limit = bytes;
+    }
+    qint64 limit() const{
+        return m_limit;
+    }
+
+    void addConsumer(QMasonryMemoryConsumer* consumer){
+        if(consumer!=nullptr && !m_consumers.contains(consumer)){
+            m_consumers.append(consumer);
+        }
+    }
+    void removeConsumer(QMasonryMemoryConsumer* consumer){
+        m_consumers.removeAll(consumer);
+    }
+
+    qint64 usage() const{
+        qint64 bytes = 0;
+        for(const QMasonryMemoryConsumer* consumer:m_consumers){
+            bytes += consumer->memoryUsage();
+        }
+        return bytes;
+    }
+
+    // Shrinks the registered caches to at most limit bytes (no limit when
+    // negative). Returns the number of bytes freed.
+    qint64 enforce(const QRect& keep_rect,qint64 limit){
+        if(limit<0){
+            return 0;
+        }
+        qint64 total = usage();
+        qint64 excess = total-limit;
+        if(excess<=0){
+            return 0;
+        }
+
+        qint64 freed = 0;
+        for(QMasonryMemoryConsumer* consumer:m_consumers){
+            qint64 share = total>0 ? excess*consumer->memoryUsage()/total : 0;
+            if(share>0){
+                freed += consumer->releaseMemory(share,keep_rect);
+            }
+        }
+        for(QMasonryMemoryConsumer* consumer:m_consumers){
+            if(freed>=excess){
+                break;
+            }
+            freed += consumer->releaseMemory(excess-freed,keep_rect);
+        }
+        return freed;
+    }
+
+    qint64 enforce(const QRect& keep_rect){
+        return m_limit>0 ? enforce(keep_rect,m_limit) : 0;
+    }
+private:
+    QList<QMasonryMemoryConsumer*> m_consumers;
+    qint64 m_limit = 0;
+};
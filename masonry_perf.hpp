@@ -0,0 +1,129 @@
+#pragma once
+#include <QtGlobal>
+#include <QString>
+
+#ifdef Q_OS_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+// Hardware counters of the calling thread, read through perf_event_open.
+// Counters the kernel or the machine doesn't provide (other platforms,
+// containers, perf_event_paranoid, virtual machines) read as -1.
+class QMasonryPerfCounters
+{
+public:
+    enum Counter{
+        Cycles,
+        Instructions,
+        CacheMisses,
+        BranchMisses,
+        CounterCount
+    };
+
+    QMasonryPerfCounters(){
+        for(int counter=0;counter<CounterCount;++counter){
+            m_fds[counter] = openCounter(Counter(counter));
+            m_values[counter] = -1;
+        }
+    }
+
+    ~QMasonryPerfCounters(){
+#ifdef Q_OS_LINUX
+        for(int fd:m_fds){
+            if(fd>=0){
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    QMasonryPerfCounters(const QMasonryPerfCounters&) = delete;
+    QMasonryPerfCounters& operator=(const QMasonryPerfCounters&) = delete;
+
+    bool isAvailable(Counter counter) const{
+        return m_fds[counter]>=0;
+    }
+
+    void start(){
+#ifdef Q_OS_LINUX
+        for(int fd:m_fds){
+            if(fd>=0){
+                ioctl(fd,PERF_EVENT_IOC_RESET,0);
+                ioctl(fd,PERF_EVENT_IOC_ENABLE,0);
+            }
+        }
+#endif
+    }
+
+    void stop(){
+        for(int counter=0;counter<CounterCount;++counter){
+            m_values[counter] = -1;
+#ifdef Q_OS_LINUX
+            int fd = m_fds[counter];
+            if(fd<0){
+                continue;
+            }
+            ioctl(fd,PERF_EVENT_IOC_DISABLE,0);
+            quint64 value = 0;
+            if(read(fd,&value,sizeof(value))==ssize_t(sizeof(value))){
+                m_values[counter] = qint64(value);
+            }
+#endif
+        }
+    }
+
+    // Value of the counter between the last start() and stop(), or -1.
+    qint64 value(Counter counter) const{
+        return m_values[counter];
+    }
+
+    static QString name(Counter counter){
+        switch (counter) {
+            case Cycles:{
+                return QStringLiteral("cycles");
+            }
+            case Instructions:{
+                return QStringLiteral("instructions");
+            }
+            case CacheMisses:{
+                return QStringLiteral("cache-misses");
+            }
+            case BranchMisses:{
+                return QStringLiteral("branch-misses");
+            }
+            default:{
+                return QString();
+            }
+        }
+    }
+private:
+    static int openCounter(Counter counter){
+#ifdef Q_OS_LINUX
+        static const quint64 configs[CounterCount] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        perf_event_attr attr;
+        memset(&attr,0,sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[counter];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return int(syscall(__NR_perf_event_open,&attr,0,-1,-1,0));
+#else
+        Q_UNUSED(counter);
+        return -1;
+#endif
+    }
+
+    int m_fds[CounterCount];
+    qint64 m_values[CounterCount];
+};
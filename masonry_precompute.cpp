@@ -0,0 +1,584 @@
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QWidget>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include "masonry.hpp"
+#if defined(__has_include)
+#if __has_include(<valgrind/callgrind.h>)
+#include <valgrind/callgrind.h>
+#define MASONRY_HAS_CALLGRIND
+#endif
+#endif
+
+// Precomputes Zoom layouts offline with the placement arithmetic of
+// QMasonryFlowLayout, without creating any widget.
+//
+// Input (a file or - for stdin) holds one board per CSV line of item ratios
+// (height/width), or the binary form: "QMSB", then per board a little-endian
+// quint32 item count followed by that many little-endian doubles.
+//
+// Output: "QMSR", quint32 version, then per board and width a record of
+// quint32 board index, quint32 width, quint32 column count, quint32 byte
+// count and the rects as QMasonryCompactRects::encode() packs them.
+//
+// With --count-instructions nothing is written; every strategy and width is
+// run as a case on one thread and its retired instructions, cycles, cache
+// and branch misses are printed as one JSON object per line, the minimum of
+// --repeat runs, so runs on noisy hosts can be diffed. Where perf counters
+// are unavailable they read -1; run the tool under
+// valgrind --tool=callgrind --collect-atstart=no instead, which gets one
+// dump per case when the callgrind header was available at build time.
+//
+// With --measure-compact nothing is written either; every strategy and width
+// is placed, cut into layout pages of --page-size items and packed with
+// QMasonryCompactRects, and the bytes per item are printed next to the 36 a
+// resident page holds (rect, fixed size, column and extent), with encode and
+// decode throughput, the best of --repeat runs, as one JSON object per line.
+//
+// The counted cases also drive a real QMasonryFlowLayout, on the offscreen
+// platform unless QT_QPA_PLATFORM says otherwise: the first --layout-items
+// ratios of the boards become tiles of a shown widget, and the "full",
+// "append" and "resize" passes of doLayout() are read from stats(), per
+// horizontal adaptation, strategy and width. The "startup" cases add that
+// many tiles to an empty layout, once with the pooled QMasonryWidgetItem
+// addWidget() creates and once with a heap QWidgetItem, and time adding
+// them and deleting the layout that owns them.
+
+struct PrecomputeOptions
+{
+    QList<int> widths;
+    int column_width = 200;
+    int horizontal_spacing = 16;
+    int vertical_spacing = 16;
+    VerticalExpansionStrategy strategy = HeightBalance;
+    int random_choices = 2;
+    quint64 random_seed = 0;
+    int layout_items = 10000;
+    int page_size = 256;
+};
+
+// A tile whose size hint is its ratio at the column width, like an image
+// tile of the feed.
+class LayoutCaseTile : public QWidget
+{
+public:
+    LayoutCaseTile(double ratio,int width,QWidget *parent): QWidget(parent),
+        m_size_hint(width,std::max(1,qRound(width*ratio))){
+        resize(m_size_hint);
+    }
+
+    QSize sizeHint() const override{
+        return m_size_hint;
+    }
+private:
+    QSize m_size_hint;
+};
+
+static void appendInteger(QByteArray& data,quint32 value){
+    for(int shift=0;shift<32;shift+=8){
+        data.append(char((value>>shift)&0xff));
+    }
+}
+
+static quint32 readInteger(const char* data){
+    quint32 value = 0;
+    for(int shift=0;shift<32;shift+=8){
+        value |= quint32(uchar(*data++))<<shift;
+    }
+    return value;
+}
+
+static bool readBoards(const QByteArray& input,QList<QList<double>>& boards){
+    if(input.startsWith("QMSB")){
+        qsizetype position = 4;
+        while(position+4<=input.size()){
+            quint32 count = readInteger(input.constData()+position);
+            position += 4;
+            if(position+qsizetype(count)*8>input.size()){
+                return false;
+            }
+            QList<double> ratios(count);
+            for(quint32 index=0;index<count;++index){
+                quint64 bits = quint64(readInteger(input.constData()+position))
+                               |(quint64(readInteger(input.constData()+position+4))<<32);
+                memcpy(&ratios[index],&bits,sizeof(double));
+                position += 8;
+            }
+            boards.append(ratios);
+        }
+        return position==input.size();
+    }
+
+    for(const QByteArray& line:input.split('\n')){
+        QByteArray fields = line.trimmed();
+        if(fields.isEmpty()){
+            continue;
+        }
+        QList<double> ratios;
+        for(const QByteArray& field:fields.split(',')){
+            bool ok = false;
+            ratios.append(field.trimmed().toDouble(&ok));
+            if(!ok){
+                return false;
+            }
+        }
+        boards.append(ratios);
+    }
+    return true;
+}
+
+static QByteArray layoutBoard(const QList<double>& ratios,int width,const PrecomputeOptions& options,int& out_column_count){
+    int column_count = QMasonryPlacement::columnCount(width,options.column_width,options.horizontal_spacing);
+    int column_width = QMasonryPlacement::realColumnWidth(width,column_count,options.horizontal_spacing);
+    QList<double> column_total_heights(column_count,0);
+    QList<QRect> rects(ratios.length());
+    QList<int> columns(ratios.length());
+    QMasonryPlacement::zoomPlace(ratios.constData(),0,ratios.length(),
+                                 column_count,column_width,options.horizontal_spacing,options.vertical_spacing,
+                                 options.strategy,options.random_choices,options.random_seed,
+                                 column_total_heights.data(),rects.data(),columns.data());
+    out_column_count = column_count;
+    return QMasonryCompactRects::encode(rects,columns,column_count);
+}
+
+static const char* strategyName(VerticalExpansionStrategy strategy){
+    static const char* names[] = {"HeightBalance","OrderInsert","RandomInsert","ChoiceInsert"};
+    return names[strategy];
+}
+
+static QByteArray countCase(const QList<QList<double>>& boards,int width,const PrecomputeOptions& options,int repeat){
+    QByteArray name = QByteArray(strategyName(options.strategy))+"/"+QByteArray::number(width);
+    QMasonryPerfCounters counters;
+    qint64 values[QMasonryPerfCounters::CounterCount];
+    std::fill(values,values+QMasonryPerfCounters::CounterCount,-1);
+    qint64 items = 0;
+    qint64 bytes = 0;
+    for(int run=0;run<repeat;++run){
+        items = 0;
+        bytes = 0;
+#ifdef MASONRY_HAS_CALLGRIND
+        CALLGRIND_ZERO_STATS;
+        CALLGRIND_TOGGLE_COLLECT;
+#endif
+        counters.start();
+        for(const QList<double>& ratios:boards){
+            int column_count = 0;
+            bytes += layoutBoard(ratios,width,options,column_count).size();
+            items += ratios.length();
+        }
+        counters.stop();
+#ifdef MASONRY_HAS_CALLGRIND
+        CALLGRIND_TOGGLE_COLLECT;
+        CALLGRIND_DUMP_STATS_AT(name.constData());
+#endif
+        for(int counter=0;counter<QMasonryPerfCounters::CounterCount;++counter){
+            qint64 value = counters.value(QMasonryPerfCounters::Counter(counter));
+            if(value>=0 && (values[counter]<0 || value<values[counter])){
+                values[counter] = value;
+            }
+        }
+    }
+
+    QByteArray line = "{\"case\":\""+name+"\",\"boards\":"+QByteArray::number(boards.length())
+                      +",\"items\":"+QByteArray::number(items)+",\"bytes\":"+QByteArray::number(bytes);
+    for(int counter=0;counter<QMasonryPerfCounters::CounterCount;++counter){
+        line += ",\""+QMasonryPerfCounters::name(QMasonryPerfCounters::Counter(counter)).toUtf8()+"\":"
+                +QByteArray::number(values[counter]);
+    }
+    return line+"}\n";
+}
+
+struct CompactPage
+{
+    QList<QRect> rects;
+    QList<int> columns;
+};
+
+static QByteArray compactCase(const QList<QList<double>>& boards,int width,const PrecomputeOptions& options,int repeat){
+    QByteArray name = QByteArray("compact/")+strategyName(options.strategy)+"/"+QByteArray::number(width);
+    int column_count = QMasonryPlacement::columnCount(width,options.column_width,options.horizontal_spacing);
+    int column_width = QMasonryPlacement::realColumnWidth(width,column_count,options.horizontal_spacing);
+    QList<CompactPage> pages;
+    qint64 items = 0;
+    for(const QList<double>& ratios:boards){
+        QList<double> column_total_heights(column_count,0);
+        QList<QRect> rects(ratios.length());
+        QList<int> columns(ratios.length());
+        QMasonryPlacement::zoomPlace(ratios.constData(),0,ratios.length(),
+                                     column_count,column_width,options.horizontal_spacing,options.vertical_spacing,
+                                     options.strategy,options.random_choices,options.random_seed,
+                                     column_total_heights.data(),rects.data(),columns.data());
+        for(int first_index=0;first_index<ratios.length();first_index+=options.page_size){
+            pages.append({rects.mid(first_index,options.page_size),columns.mid(first_index,options.page_size)});
+        }
+        items += ratios.length();
+    }
+
+    QList<QByteArray> encoded(pages.length());
+    qint64 encode_nsecs = -1;
+    qint64 decode_nsecs = -1;
+    qint64 bytes = 0;
+    bool exact = true;
+    for(int run=0;run<repeat;++run){
+        QElapsedTimer timer;
+        timer.start();
+        for(int page_index=0;page_index<pages.length();++page_index){
+            encoded[page_index] = QMasonryCompactRects::encode(pages[page_index].rects,pages[page_index].columns,column_count);
+        }
+        qint64 nsecs = timer.nsecsElapsed();
+        encode_nsecs = encode_nsecs<0 ? nsecs : std::min(encode_nsecs,nsecs);
+
+        timer.restart();
+        QList<QList<QRect>> decoded(pages.length());
+        for(int page_index=0;page_index<pages.length();++page_index){
+            decoded[page_index] = QMasonryCompactRects::decode(encoded[page_index]);
+        }
+        nsecs = timer.nsecsElapsed();
+        decode_nsecs = decode_nsecs<0 ? nsecs : std::min(decode_nsecs,nsecs);
+
+        bytes = 0;
+        for(int page_index=0;page_index<pages.length();++page_index){
+            bytes += encoded[page_index].size();
+            exact = exact && decoded[page_index]==pages[page_index].rects;
+        }
+    }
+
+    double item_count = std::max<qint64>(1,items);
+    auto items_per_second = [&](qint64 nsecs){
+        return QByteArray::number(items*1e9/std::max<qint64>(1,nsecs),'f',0);
+    };
+    return "{\"case\":\""+name+"\",\"items\":"+QByteArray::number(items)
+           +",\"pages\":"+QByteArray::number(pages.length())
+           +",\"compact_bytes\":"+QByteArray::number(bytes)
+           +",\"compact_bytes_per_item\":"+QByteArray::number(bytes/item_count,'f',2)
+           +",\"resident_bytes_per_item\":"+QByteArray::number(int(sizeof(QRect)+sizeof(QSize)+sizeof(int)+sizeof(double)))
+           +",\"encode_items_per_sec\":"+items_per_second(encode_nsecs)
+           +",\"decode_items_per_sec\":"+items_per_second(decode_nsecs)
+           +",\"exact\":"+(exact ? "true" : "false")+"}\n";
+}
+
+static const char* adaptionName(HorizontalAdaptationStrategy adaption){
+    static const char* names[] = {"NoAdaption","Spacing","Zoom"};
+    return names[adaption];
+}
+
+// Keeps the smaller of the runs' values, counters that could not be read
+// staying at -1.
+static void keepMinimum(QMasonryLayoutStats& minimum,const QMasonryLayoutStats& stats,bool first_run){
+    if(first_run){
+        minimum = stats;
+        return;
+    }
+    minimum.nsecs = std::min(minimum.nsecs,stats.nsecs);
+    for(int counter=0;counter<QMasonryPerfCounters::CounterCount;++counter){
+        qint64 value = stats.counters[counter];
+        if(value>=0 && (minimum.counters[counter]<0 || value<minimum.counters[counter])){
+            minimum.counters[counter] = value;
+        }
+    }
+}
+
+static QByteArray layoutCaseLine(const QByteArray& name,const QMasonryLayoutStats& stats){
+    QByteArray line = "{\"case\":\""+name+"\",\"passes\":"+QByteArray::number(stats.passes)
+                      +",\"computed_items\":"+QByteArray::number(stats.computed_items)
+                      +",\"committed_items\":"+QByteArray::number(stats.committed_items)
+                      +",\"nsecs\":"+QByteArray::number(stats.nsecs);
+    for(int counter=0;counter<QMasonryPerfCounters::CounterCount;++counter){
+        line += ",\""+QMasonryPerfCounters::name(QMasonryPerfCounters::Counter(counter)).toUtf8()+"\":"
+                +QByteArray::number(stats.counters[counter]);
+    }
+    return line+"}\n";
+}
+
+// Runs the passes of one layout case. Every run builds the board again:
+// nine tenths of the tiles are laid out by showing the parent, then
+// "full" places all of them again at width, "append" places the last tenth
+// added after them and "resize" places everything at three quarters of width.
+static QByteArray layoutCase(const QList<double>& ratios,int width,HorizontalAdaptationStrategy adaption,
+                             const PrecomputeOptions& options,int repeat){
+    QByteArray name = QByteArray("layout/")+adaptionName(adaption)+"/"+strategyName(options.strategy)
+                      +"/"+QByteArray::number(width);
+    const char* pass_names[] = {"full","append","resize"};
+    QMasonryLayoutStats pass_stats[3];
+    int initial_count = ratios.length()-ratios.length()/10;
+    for(int run=0;run<repeat;++run){
+        QWidget parent;
+        auto layout = new QMasonryFlowLayout(&parent);
+        layout->setContentsMargins(0,0,0,0);
+        layout->setHorizontalAdaption(adaption);
+        layout->setVerticalExpansion(options.strategy);
+        layout->setRandomChoices(options.random_choices);
+        layout->setRandomSeed(options.random_seed);
+        layout->setColumnWidth(options.column_width);
+        layout->setHorizontalSpacing(options.horizontal_spacing);
+        layout->setVerticalSpacing(options.vertical_spacing);
+        for(int index=0;index<initial_count;++index){
+            layout->addWidget(new LayoutCaseTile(ratios[index],options.column_width,&parent));
+        }
+        parent.resize(width,800);
+        parent.show();
+        QApplication::processEvents();
+        layout->setPerfCountersEnabled(true);
+
+        for(int pass=0;pass<3;++pass){
+            QRect rect(0,0,width,800);
+            if(pass==0){
+                layout->setHorizontalSpacing(options.horizontal_spacing);
+            }else if(pass==1){
+                for(int index=initial_count;index<ratios.length();++index){
+                    layout->addWidget(new LayoutCaseTile(ratios[index],options.column_width,&parent));
+                }
+            }else{
+                rect.setWidth(std::max(1,width*3/4));
+            }
+            QByteArray pass_name = name+"/"+pass_names[pass];
+            layout->resetStats();
+#ifdef MASONRY_HAS_CALLGRIND
+            CALLGRIND_ZERO_STATS;
+            CALLGRIND_TOGGLE_COLLECT;
+#endif
+            layout->setGeometry(rect);
+#ifdef MASONRY_HAS_CALLGRIND
+            CALLGRIND_TOGGLE_COLLECT;
+            CALLGRIND_DUMP_STATS_AT(pass_name.constData());
+#endif
+            keepMinimum(pass_stats[pass],layout->stats(),run==0);
+        }
+    }
+
+    QByteArray lines;
+    for(int pass=0;pass<3;++pass){
+        lines += layoutCaseLine(name+"/"+pass_names[pass],pass_stats[pass]);
+    }
+    return lines;
+}
+
+// Times adding the tiles of ratios to a layout and deleting it, with
+// items of one kind. The tiles are created before the clock starts, so
+// only the items and the layout's own bookkeeping are timed.
+static QByteArray startupCase(const QList<double>& ratios,bool pooled,const PrecomputeOptions& options,int repeat){
+    QByteArray name = QByteArray("startup/")+(pooled ? "pooled" : "heap");
+    qint64 add_nsecs = -1;
+    qint64 teardown_nsecs = -1;
+    for(int run=0;run<repeat;++run){
+        QWidget parent;
+        QList<QWidget*> tiles(ratios.length());
+        for(int index=0;index<ratios.length();++index){
+            tiles[index] = new LayoutCaseTile(ratios[index],options.column_width,&parent);
+        }
+        auto layout = new QMasonryFlowLayout(&parent);
+
+        QElapsedTimer timer;
+        timer.start();
+        for(QWidget* tile:tiles){
+            if(pooled){
+                layout->addItem(new QMasonryWidgetItem(tile));
+            }else{
+                layout->addItem(new QWidgetItem(tile));
+            }
+        }
+        qint64 nsecs = timer.nsecsElapsed();
+        add_nsecs = add_nsecs<0 ? nsecs : std::min(add_nsecs,nsecs);
+
+        timer.restart();
+        delete layout;
+        nsecs = timer.nsecsElapsed();
+        teardown_nsecs = teardown_nsecs<0 ? nsecs : std::min(teardown_nsecs,nsecs);
+    }
+
+    double item_count = std::max<qsizetype>(1,ratios.length());
+    return "{\"case\":\""+name+"\",\"items\":"+QByteArray::number(ratios.length())
+           +",\"add_nsecs\":"+QByteArray::number(add_nsecs)
+           +",\"add_nsecs_per_item\":"+QByteArray::number(add_nsecs/item_count,'f',1)
+           +",\"teardown_nsecs\":"+QByteArray::number(teardown_nsecs)
+           +",\"teardown_nsecs_per_item\":"+QByteArray::number(teardown_nsecs/item_count,'f',1)+"}\n";
+}
+
+static bool openFile(QFile& file,const QString& path,QIODevice::OpenMode mode,FILE* standard_stream){
+    if(path==QLatin1String("-")){
+        return file.open(standard_stream,mode);
+    }
+    file.setFileName(path);
+    return file.open(mode);
+}
+
+static bool parseStrategy(const QString& name,VerticalExpansionStrategy& strategy){
+    for(int index=0;index<4;++index){
+        if(name.compare(QLatin1String(strategyName(VerticalExpansionStrategy(index))),Qt::CaseInsensitive)==0){
+            strategy = VerticalExpansionStrategy(index);
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc,char** argv){
+    if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")){
+        qputenv("QT_QPA_PLATFORM","offscreen");
+    }
+    QApplication app(argc,argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Precomputes masonry layouts for boards of item ratios."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("input"),QStringLiteral("CSV or binary ratios, - for stdin."));
+    parser.addPositionalArgument(QStringLiteral("output"),QStringLiteral("Binary rects file, - for stdout. Not used with --count-instructions or --measure-compact."));
+    QCommandLineOption widths_option(QStringLiteral("widths"),QStringLiteral("Comma separated content widths."),QStringLiteral("widths"),QStringLiteral("1200"));
+    QCommandLineOption column_width_option(QStringLiteral("column-width"),QStringLiteral("Target column width."),QStringLiteral("pixels"),QStringLiteral("200"));
+    QCommandLineOption spacing_option(QStringLiteral("spacing"),QStringLiteral("Horizontal and vertical spacing."),QStringLiteral("pixels"),QStringLiteral("16"));
+    QCommandLineOption strategy_option(QStringLiteral("strategy"),QStringLiteral("HeightBalance, OrderInsert, RandomInsert or ChoiceInsert."),QStringLiteral("name"),QStringLiteral("HeightBalance"));
+    QCommandLineOption choices_option(QStringLiteral("choices"),QStringLiteral("Columns sampled by ChoiceInsert."),QStringLiteral("count"),QStringLiteral("2"));
+    QCommandLineOption seed_option(QStringLiteral("seed"),QStringLiteral("Seed of the random strategies."),QStringLiteral("seed"),QStringLiteral("0"));
+    QCommandLineOption threads_option(QStringLiteral("threads"),QStringLiteral("Worker threads, all cores by default."),QStringLiteral("count"));
+    QCommandLineOption count_option(QStringLiteral("count-instructions"),QStringLiteral("Print per-case instruction counts as JSON lines instead of writing rects."));
+    QCommandLineOption repeat_option(QStringLiteral("repeat"),QStringLiteral("Runs per counted case, the minimum is kept."),QStringLiteral("count"),QStringLiteral("3"));
+    QCommandLineOption compact_option(QStringLiteral("measure-compact"),QStringLiteral("Print compact rect size and encode/decode throughput as JSON lines instead of writing rects."));
+    QCommandLineOption page_size_option(QStringLiteral("page-size"),QStringLiteral("Items per compacted layout page."),QStringLiteral("count"),QStringLiteral("256"));
+    QCommandLineOption layout_items_option(QStringLiteral("layout-items"),QStringLiteral("Tiles of the counted layout and startup cases, 0 skips them."),QStringLiteral("count"),QStringLiteral("10000"));
+    for(const QCommandLineOption* option:{&widths_option,&column_width_option,&spacing_option,&strategy_option,
+                                           &choices_option,&seed_option,&threads_option,&count_option,&repeat_option,
+                                           &compact_option,&page_size_option,&layout_items_option}){
+        parser.addOption(*option);
+    }
+    parser.process(app);
+
+    QTextStream err(stderr);
+    QStringList arguments = parser.positionalArguments();
+    bool count_instructions = parser.isSet(count_option);
+    bool measure_compact = parser.isSet(compact_option);
+    if(arguments.length()!=(count_instructions || measure_compact ? 1 : 2)){
+        parser.showHelp(1);
+    }
+
+    PrecomputeOptions options;
+    for(const QString& width:parser.value(widths_option).split(QLatin1Char(','))){
+        options.widths.append(std::max(1,width.toInt()));
+    }
+    options.column_width = std::max(1,parser.value(column_width_option).toInt());
+    options.horizontal_spacing = parser.value(spacing_option).toInt();
+    options.vertical_spacing = options.horizontal_spacing;
+    options.random_choices = std::max(1,parser.value(choices_option).toInt());
+    options.random_seed = parser.value(seed_option).toULongLong();
+    options.layout_items = std::max(0,parser.value(layout_items_option).toInt());
+    options.page_size = std::max(1,parser.value(page_size_option).toInt());
+    if(!parseStrategy(parser.value(strategy_option),options.strategy)){
+        err<<"Unknown strategy "<<parser.value(strategy_option)<<"\n";
+        return 1;
+    }
+    if(parser.isSet(threads_option)){
+        QThreadPool::globalInstance()->setMaxThreadCount(std::max(1,parser.value(threads_option).toInt()));
+    }
+
+    QFile input;
+    if(!openFile(input,arguments[0],QIODevice::ReadOnly,stdin)){
+        err<<"Cannot open "<<arguments[0]<<"\n";
+        return 1;
+    }
+    QList<QList<double>> boards;
+    if(!readBoards(input.readAll(),boards)){
+        err<<"Malformed input "<<arguments[0]<<"\n";
+        return 1;
+    }
+
+    if(count_instructions || measure_compact){
+        QList<VerticalExpansionStrategy> strategies;
+        if(parser.isSet(strategy_option)){
+            strategies.append(options.strategy);
+        }else{
+            strategies = {HeightBalance,OrderInsert,RandomInsert,ChoiceInsert};
+        }
+        QFile output;
+        output.open(stdout,QIODevice::WriteOnly);
+        int repeat = std::max(1,parser.value(repeat_option).toInt());
+        QList<double> layout_ratios;
+        for(const QList<double>& ratios:boards){
+            if(layout_ratios.length()>=options.layout_items){
+                break;
+            }
+            layout_ratios.append(ratios.mid(0,options.layout_items-layout_ratios.length()));
+        }
+        if(count_instructions && !layout_ratios.isEmpty()){
+            for(bool pooled:{true,false}){
+                output.write(startupCase(layout_ratios,pooled,options,repeat));
+                output.flush();
+            }
+        }
+        for(VerticalExpansionStrategy strategy:strategies){
+            options.strategy = strategy;
+            if(measure_compact){
+                for(int width:options.widths){
+                    output.write(compactCase(boards,width,options,repeat));
+                    output.flush();
+                }
+                continue;
+            }
+            for(int width:options.widths){
+                output.write(countCase(boards,width,options,repeat));
+                output.flush();
+            }
+            if(layout_ratios.isEmpty()){
+                continue;
+            }
+            for(HorizontalAdaptationStrategy adaption:{Zoom,Spacing}){
+                for(int width:options.widths){
+                    output.write(layoutCase(layout_ratios,width,adaption,options,repeat));
+                    output.flush();
+                }
+            }
+        }
+        return 0;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    int width_count = options.widths.length();
+    QList<QByteArray> records(boards.length()*width_count);
+    // Workers only read the boards and fill disjoint records, through
+    // pointers taken here so no QList is touched from several threads.
+    const QList<double>* board_data = boards.constData();
+    QByteArray* record_data = records.data();
+    int board_count = boards.length();
+    std::atomic<int> next_board(0);
+    int worker_count = QThreadPool::globalInstance()->maxThreadCount();
+    for(int worker=0;worker<worker_count;++worker){
+        QThreadPool::globalInstance()->start([&](){
+            for(int board_index=next_board++;board_index<board_count;board_index=next_board++){
+                for(int width_index=0;width_index<width_count;++width_index){
+                    int width = options.widths[width_index];
+                    int column_count = 0;
+                    QByteArray rects = layoutBoard(board_data[board_index],width,options,column_count);
+                    QByteArray& record = record_data[board_index*width_count+width_index];
+                    appendInteger(record,quint32(board_index));
+                    appendInteger(record,quint32(width));
+                    appendInteger(record,quint32(column_count));
+                    appendInteger(record,quint32(rects.size()));
+                    record.append(rects);
+                }
+            }
+        });
+    }
+    QThreadPool::globalInstance()->waitForDone();
+    qint64 nsecs = std::max<qint64>(1,timer.nsecsElapsed());
+
+    QFile output;
+    if(!openFile(output,arguments[1],QIODevice::WriteOnly|QIODevice::Truncate,stdout)){
+        err<<"Cannot write "<<arguments[1]<<"\n";
+        return 1;
+    }
+    QByteArray header("QMSR");
+    appendInteger(header,1);
+    output.write(header);
+    for(const QByteArray& record:records){
+        output.write(record);
+    }
+    output.close();
+
+    err<<boards.length()<<" boards, "<<records.length()<<" layouts in "<<QString::number(nsecs/1e6,'f',1)<<" ms, "
+       <<QString::number(boards.length()*1e9/nsecs,'f',1)<<" boards/s\n";
+    return 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <QWidget>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QPixmap>
+#include <QEvent>
+#include <QElapsedTimer>
+
+// An opaque child laid over a tile that shows a snapshot of it. While it is
+// engaged, Qt paints neither the tile nor any of its children underneath, so
+// a complex tile costs one pixmap blit per frame. The snapshot is dropped
+// when the tile is resized; entering or clicking the proxy hands the tile
+// back. The proxy is shown once and then only resized: showing or hiding a
+// child asks its parent for a new layout, which would make every engage
+// and release a layout pass of the board.
+class QMasonryRenderProxy : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit QMasonryRenderProxy(QWidget *tile): QWidget(tile), m_tile(tile){
+        setAttribute(Qt::WA_OpaquePaintEvent);
+        setAttribute(Qt::WA_NoSystemBackground);
+        setGeometry(QRect());
+        show();
+        tile->installEventFilter(this);
+    }
+
+    QWidget* tile() const{
+        return m_tile;
+    }
+
+    bool hasSnapshot() const{
+        return !m_snapshot.isNull();
+    }
+
+    qint64 snapshotBytes() const{
+        return qint64(m_snapshot.width())*m_snapshot.height()*m_snapshot.depth()/8;
+    }
+
+    // Milliseconds since the snapshot was taken or last shown.
+    qint64 idleTime() const{
+        return m_last_used.isValid() ? m_last_used.elapsed() : 0;
+    }
+
+    // Renders the tile and its children, but not this proxy, into the
+    // snapshot.
+    void capture(){
+        release();
+        m_snapshot = m_tile->grab();
+        m_last_used.start();
+    }
+
+    void invalidate(){
+        m_snapshot = QPixmap();
+        release();
+    }
+
+    // Covers the tile with the snapshot, if there is one.
+    void engage(){
+        if(!hasSnapshot() || m_engaged){
+            return;
+        }
+        setGeometry(m_tile->rect());
+        raise();
+        m_engaged = true;
+        m_last_used.start();
+    }
+
+    // Collapses the proxy to nothing, which Qt neither paints nor sends
+    // pointer events to.
+    void release(){
+        if(m_engaged){
+            setGeometry(QRect());
+            m_engaged = false;
+        }
+    }
+
+    bool isEngaged() const{
+        return m_engaged;
+    }
+protected:
+    void paintEvent(QPaintEvent *event) override{
+        QPainter painter(this);
+        painter.setClipRegion(event->region());
+        painter.drawPixmap(0,0,m_snapshot);
+    }
+
+    bool event(QEvent *event) override{
+        switch (event->type()) {
+            case QEvent::Enter:
+            case QEvent::MouseButtonPress:{
+                release();
+                break;
+            }
+            default:{
+                break;
+            }
+        }
+        return QWidget::event(event);
+    }
+
+    bool eventFilter(QObject *watched,QEvent *event) override{
+        if(watched==m_tile && event->type()==QEvent::Resize){
+            invalidate();
+        }
+        return QWidget::eventFilter(watched,event);
+    }
+private:
+    QWidget* m_tile;
+    QPixmap m_snapshot;
+    QElapsedTimer m_last_used;
+    bool m_engaged = false;
+};
@@ -0,0 +1,285 @@
+#pragma once
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QThreadPool>
+#include <functional>
+
+// Scaled tile images persisted across runs. Pixels are appended to a pack
+// file that is memory-mapped for reading, and an append-only index maps
+// (content hash, quantized column width) to their place in the pack, so a
+// cold start can paint cached tiles straight from the page cache without
+// opening or decoding the original images. The pack grows by doubling its
+// reserved size, so the number of mappings stays logarithmic in its size.
+class QMasonryThumbnailCache
+{
+public:
+    explicit QMasonryThumbnailCache(const QString& directory,int width_step = 32){
+        m_width_step = std::max(1,width_step);
+        QDir().mkpath(directory);
+        m_pack.setFileName(QDir(directory).filePath(QStringLiteral("thumbnails.pack")));
+        m_index.setFileName(QDir(directory).filePath(QStringLiteral("thumbnails.index")));
+        if(!m_pack.open(QIODevice::ReadWrite) || !m_index.open(QIODevice::ReadWrite)){
+            m_pack.close();
+            m_index.close();
+            return;
+        }
+        loadIndex();
+    }
+
+    ~QMasonryThumbnailCache(){
+        for(uchar* chunk:m_chunks){
+            m_pack.unmap(chunk);
+        }
+    }
+
+    QMasonryThumbnailCache(const QMasonryThumbnailCache&) = delete;
+    QMasonryThumbnailCache& operator=(const QMasonryThumbnailCache&) = delete;
+
+    bool isOpen() const{
+        return m_pack.isOpen() && m_index.isOpen();
+    }
+
+    // Widths are rounded up to a multiple of the width step, so that small
+    // column width changes share one cached image.
+    int quantizedWidth(int width) const{
+        return (width+m_width_step-1)/m_width_step*m_width_step;
+    }
+
+    static QByteArray contentHash(const QByteArray& content){
+        return QCryptographicHash::hash(content,QCryptographicHash::Sha1);
+    }
+
+    // Stands in for the content hash of a file, from its path, size and
+    // modification time, so it is known without reading the file.
+    static QByteArray sourceHash(const QString& source_path){
+        QFileInfo info(source_path);
+        QByteArray key = info.absoluteFilePath().toUtf8();
+        key.append('\0');
+        key.append(QByteArray::number(info.size()));
+        key.append('\0');
+        key.append(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+        return QCryptographicHash::hash(key,QCryptographicHash::Sha1);
+    }
+
+    // The cached image for content_hash at the quantized width, or a null
+    // image. The image shares the mapped pack and stays valid while the
+    // cache lives.
+    QImage find(const QByteArray& content_hash,int width){
+        QMutexLocker locker(&m_mutex);
+        auto entry = m_entries.constFind(entryKey(content_hash,quantizedWidth(width)));
+        if(entry==m_entries.constEnd()){
+            return QImage();
+        }
+        const uchar* pixels = mappedPixels(entry.value());
+        if(pixels==nullptr){
+            return QImage();
+        }
+        return QImage(pixels,entry->width,entry->height,entry->bytes_per_line,QImage::Format_ARGB32_Premultiplied);
+    }
+
+    bool insert(const QByteArray& content_hash,int width,const QImage& image){
+        QMutexLocker locker(&m_mutex);
+        if(!isOpen() || image.isNull()){
+            return false;
+        }
+        QByteArray key = entryKey(content_hash,quantizedWidth(width));
+        if(m_entries.contains(key)){
+            return true;
+        }
+
+        QImage pixels = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        Entry entry;
+        entry.width = pixels.width();
+        entry.height = pixels.height();
+        entry.bytes_per_line = pixels.bytesPerLine();
+        entry.offset = m_pack_end;
+        qint64 size = qint64(entry.bytes_per_line)*entry.height;
+        if(entry.offset+size>m_pack.size()){
+            // An image that doesn't fit the reserve starts the next one, so
+            // no image straddles two mappings.
+            entry.offset = m_pack.size();
+            if(!reservePack(entry.offset+size)){
+                return false;
+            }
+        }
+        if(!m_pack.seek(entry.offset) || m_pack.write(reinterpret_cast<const char*>(pixels.constBits()),size)!=size){
+            return false;
+        }
+        m_pack.flush();
+        m_pack_end = entry.offset+size;
+
+        QByteArray record = key;
+        appendInteger(record,entry.width);
+        appendInteger(record,entry.height);
+        appendInteger(record,entry.bytes_per_line);
+        appendInteger(record,quint32(entry.offset));
+        appendInteger(record,quint32(entry.offset>>32));
+        if(!m_index.seek(m_index.size()) || m_index.write(record)!=record.size()){
+            return false;
+        }
+        m_index.flush();
+        m_entries.insert(key,entry);
+        return true;
+    }
+
+    // Returns the cached tile for the image file at source_path, decoding,
+    // scaling and storing it on a miss. Safe to call from worker threads.
+    // The original is only opened on a miss: content_hash comes from the
+    // caller (feed metadata, say), and without one the file is keyed by
+    // sourceHash().
+    QImage thumbnail(const QByteArray& content_hash,const QString& source_path,int width){
+        QImage image = find(content_hash,width);
+        if(!image.isNull()){
+            return image;
+        }
+
+        QFile source(source_path);
+        if(!source.open(QIODevice::ReadOnly)){
+            return QImage();
+        }
+        image = QImage::fromData(source.readAll());
+        if(image.isNull()){
+            return QImage();
+        }
+        image = image.scaledToWidth(quantizedWidth(width),Qt::SmoothTransformation);
+        insert(content_hash,width,image);
+        return image;
+    }
+    QImage thumbnail(const QString& source_path,int width){
+        return thumbnail(sourceHash(source_path),source_path,width);
+    }
+
+    // Runs thumbnail() on the global thread pool and hands the image to
+    // on_ready in context's thread, unless context was destroyed meanwhile.
+    // The cache must outlive the request.
+    void requestThumbnail(const QString& source_path,int width,QObject* context,
+                          const std::function<void(const QImage&)>& on_ready){
+        requestThumbnail(QByteArray(),source_path,width,context,on_ready);
+    }
+    void requestThumbnail(const QByteArray& content_hash,const QString& source_path,int width,QObject* context,
+                          const std::function<void(const QImage&)>& on_ready){
+        QPointer<QObject> guard(context);
+        QThreadPool::globalInstance()->start([this,content_hash,source_path,width,guard,on_ready](){
+            QImage image = thumbnail(content_hash.isEmpty() ? sourceHash(source_path) : content_hash,source_path,width);
+            if(guard.isNull()){
+                return;
+            }
+            QMetaObject::invokeMethod(guard.data(),[guard,on_ready,image](){
+                if(!guard.isNull()){
+                    on_ready(image);
+                }
+            },Qt::QueuedConnection);
+        });
+    }
+private:
+    struct Entry{
+        quint32 width = 0;
+        quint32 height = 0;
+        quint32 bytes_per_line = 0;
+        qint64 offset = 0;
+    };
+
+    struct Chunk{
+        qint64 offset;
+        qint64 size;
+    };
+
+    static constexpr int kHashSize = 20;
+    static constexpr qint64 kMinPackReserve = 16*1024*1024;
+    static constexpr int kRecordSize = kHashSize+4+4*5;
+
+    static QByteArray entryKey(const QByteArray& content_hash,int width){
+        QByteArray key = content_hash.leftJustified(kHashSize,'\0',true);
+        appendInteger(key,quint32(width));
+        return key;
+    }
+
+    static void appendInteger(QByteArray& data,quint32 value){
+        for(int shift=0;shift<32;shift+=8){
+            data.append(char((value>>shift)&0xff));
+        }
+    }
+
+    static quint32 readInteger(const char* data){
+        quint32 value = 0;
+        for(int shift=0;shift<32;shift+=8){
+            value |= quint32(uchar(*data++))<<shift;
+        }
+        return value;
+    }
+
+    void loadIndex(){
+        QByteArray records = m_index.readAll();
+        qint64 pack_size = m_pack.size();
+        int record_count = records.size()/kRecordSize;
+        for(int record_index=0;record_index<record_count;++record_index){
+            const char* record = records.constData()+qsizetype(record_index)*kRecordSize;
+            const char* fields = record+kHashSize+4;
+            Entry entry;
+            entry.width = readInteger(fields);
+            entry.height = readInteger(fields+4);
+            entry.bytes_per_line = readInteger(fields+8);
+            entry.offset = qint64(readInteger(fields+12))|(qint64(readInteger(fields+16))<<32);
+            qint64 entry_end = entry.offset+qint64(entry.bytes_per_line)*entry.height;
+            if(entry_end>pack_size){
+                continue;
+            }
+            m_pack_end = std::max(m_pack_end,entry_end);
+            m_entries.insert(QByteArray(record,kHashSize+4),entry);
+        }
+        // Drop a torn trailing record left by an interrupted write.
+        m_index.resize(qint64(record_count)*kRecordSize);
+    }
+
+    // Grows the pack file to at least end, doubling it, so that a new
+    // mapping is only needed as often as the pack doubles. The reserved
+    // tail past m_pack_end holds no image yet.
+    bool reservePack(qint64 end){
+        return m_pack.resize(std::max(end,std::max(kMinPackReserve,m_pack.size()*2)));
+    }
+
+    const uchar* mappedPixels(const Entry& entry){
+        qint64 size = qint64(entry.bytes_per_line)*entry.height;
+        for(int chunk_index=0;chunk_index<m_chunk_ranges.length();++chunk_index){
+            const Chunk& chunk = m_chunk_ranges[chunk_index];
+            if(entry.offset>=chunk.offset && entry.offset+size<=chunk.offset+chunk.size){
+                return m_chunks[chunk_index]+(entry.offset-chunk.offset);
+            }
+        }
+        // The pack grew since the last mapping: its new reserve becomes a new
+        // chunk, which later writes below the pack's size show up in. Earlier
+        // chunks stay mapped because images may still point into them.
+        qint64 mapped_end = m_chunk_ranges.isEmpty() ? 0 : m_chunk_ranges.last().offset+m_chunk_ranges.last().size;
+        qint64 pack_size = m_pack.size();
+        if(entry.offset<mapped_end || entry.offset+size>pack_size){
+            return nullptr;
+        }
+        uchar* chunk = m_pack.map(mapped_end,pack_size-mapped_end);
+        if(chunk==nullptr){
+            return nullptr;
+        }
+        m_chunks.append(chunk);
+        m_chunk_ranges.append({mapped_end,pack_size-mapped_end});
+        return chunk+(entry.offset-mapped_end);
+    }
+
+    int m_width_step = 32;
+    QFile m_pack;
+    qint64 m_pack_end = 0;
+    QFile m_index;
+    QHash<QByteArray,Entry> m_entries;
+    QList<uchar*> m_chunks;
+    QList<Chunk> m_chunk_ranges;
+    QMutex m_mutex;
+};
@@ -0,0 +1,240 @@
+#pragma once
+#include <QAbstractScrollArea>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QResizeEvent>
+#include <QScrollBar>
+#include <QRegion>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include "masonry.hpp"
+
+// A board painted by one delegate in a single viewport instead of a widget
+// per tile. Tiles are placed like a Zoom layout from the ratios of a
+// QMasonryItemStore. Scrolling shifts the pixels already on screen and only
+// the exposed strip is repainted, with the tiles that intersect it looked up
+// per column, so a scrolled frame costs what was scrolled in.
+class QMasonryView : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    typedef std::function<void(QPainter*,int,const QRect&)> PaintItem;
+
+    explicit QMasonryView(QWidget *parent = nullptr): QAbstractScrollArea(parent){
+        verticalScrollBar()->setSingleStep(48);
+        setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    }
+
+    void setItemStore(const std::shared_ptr<QMasonryItemStore>& store){
+        if(m_item_store!=nullptr){
+            disconnect(m_item_store.get(),nullptr,this,nullptr);
+        }
+        m_item_store = store;
+        if(store!=nullptr){
+            connect(store.get(),&QMasonryItemStore::itemsAppended,this,[this](int first,int count){
+                placeItems(first,first+count);
+            });
+            connect(store.get(),&QMasonryItemStore::itemChanged,this,[this](int index){
+                Q_UNUSED(index);
+                relayout();
+            });
+            connect(store.get(),&QMasonryItemStore::itemsReset,this,[this](){
+                relayout();
+            });
+        }
+        relayout();
+    }
+    std::shared_ptr<QMasonryItemStore> itemStore() const{
+        return m_item_store;
+    }
+
+    // Paints the item at index into rect, in viewport coordinates.
+    void setPaintItem(const PaintItem& paint_item){
+        m_paint_item = paint_item;
+        viewport()->update();
+    }
+
+    void setColumnWidth(int width){
+        m_column_width = std::max(1,width);
+        relayout();
+    }
+    int columnWidth() const{
+        return m_column_width;
+    }
+
+    void setHorizontalSpacing(int spacing){
+        m_horizontal_spacing = spacing;
+        relayout();
+    }
+    int horizontalSpacing() const{
+        return m_horizontal_spacing;
+    }
+
+    void setVerticalSpacing(int spacing){
+        m_vertical_spacing = spacing;
+        relayout();
+    }
+    int verticalSpacing() const{
+        return m_vertical_spacing;
+    }
+
+    // Space around the tiles. Margins that keep the content width only move
+    // the board, which repaints it with no tile placed again.
+    void setBoardMargins(const QMargins& margins){
+        bool resized = margins.left()+margins.right()!=m_board_margins.left()+m_board_margins.right();
+        m_board_margins = margins;
+        if(resized){
+            relayout();
+        }else{
+            updateScrollBar();
+            viewport()->update();
+        }
+    }
+    QMargins boardMargins() const{
+        return m_board_margins;
+    }
+
+    // HeightBalance, OrderInsert and ChoiceInsert work alike here; the
+    // random strategies use the store index for their draws.
+    void setVerticalExpansion(VerticalExpansionStrategy strategy){
+        m_vertical_expansion = strategy;
+        relayout();
+    }
+    VerticalExpansionStrategy verticalExpansion() const{
+        return m_vertical_expansion;
+    }
+
+    // Rect of the item at index in content coordinates.
+    QRect itemRect(int index) const{
+        return m_rects.value(index).translated(boardOffset());
+    }
+
+    // Items intersecting rect (content coordinates), in index order. Each
+    // column keeps its items top to bottom, so this is a binary search per
+    // column plus the items found.
+    QList<int> itemsIn(const QRect& rect) const{
+        return placedItemsIn(rect.translated(-boardOffset()));
+    }
+
+    // Index of the item under a viewport position, or -1.
+    int itemAt(const QPoint& position) const{
+        QPoint content_position = position+QPoint(0,verticalScrollBar()->value());
+        QList<int> indexes = itemsIn(QRect(content_position,QSize(1,1)));
+        return indexes.isEmpty() ? -1 : indexes.first();
+    }
+protected:
+    void scrollContentsBy(int dx,int dy) override{
+        viewport()->scroll(dx,dy);
+    }
+
+    void paintEvent(QPaintEvent *event) override{
+        if(!m_paint_item){
+            return;
+        }
+        QPainter painter(viewport());
+        painter.setClipRegion(event->region());
+        QPoint offset = boardOffset()-QPoint(0,verticalScrollBar()->value());
+        for(int index:placedItemsIn(event->region().boundingRect().translated(-offset))){
+            QRect rect = m_rects[index].translated(offset);
+            if(event->region().intersects(rect)){
+                m_paint_item(&painter,index,rect);
+            }
+        }
+    }
+
+    void resizeEvent(QResizeEvent *event) override{
+        QAbstractScrollArea::resizeEvent(event);
+        if(event->size().width()!=event->oldSize().width()){
+            relayout();
+        }else{
+            updateScrollBar();
+        }
+    }
+private:
+    std::shared_ptr<QMasonryItemStore> m_item_store;
+    PaintItem m_paint_item;
+
+    VerticalExpansionStrategy m_vertical_expansion = HeightBalance;
+    int m_column_width = 200;
+    int m_horizontal_spacing = 16;
+    int m_vertical_spacing = 16;
+    QMargins m_board_margins;
+
+    int m_column_count = 1;
+    int m_real_column_width = 0;
+    QList<double> m_column_total_heights;
+    QList<QList<int>> m_column_items;
+    QList<QRect> m_rects;
+
+    // Tiles are placed from the origin; the margins are applied as an
+    // offset when they are shown.
+    QPoint boardOffset() const{
+        return QPoint(m_board_margins.left(),m_board_margins.top());
+    }
+
+    // Items intersecting rect in placement coordinates.
+    QList<int> placedItemsIn(const QRect& rect) const{
+        QList<int> indexes;
+        for(const QList<int>& column_items:m_column_items){
+            auto first = std::lower_bound(column_items.begin(),column_items.end(),rect.top(),[this](int index,int top){
+                return m_rects[index].bottom()<top;
+            });
+            for(auto it=first;it!=column_items.end() && m_rects[*it].top()<=rect.bottom();++it){
+                if(m_rects[*it].intersects(rect)){
+                    indexes.append(*it);
+                }
+            }
+        }
+        std::sort(indexes.begin(),indexes.end());
+        return indexes;
+    }
+
+    void relayout(){
+        int content_width = viewport()->width()-m_board_margins.left()-m_board_margins.right();
+        m_column_count = QMasonryPlacement::columnCount(content_width,m_column_width,m_horizontal_spacing);
+        m_real_column_width = QMasonryPlacement::realColumnWidth(content_width,m_column_count,m_horizontal_spacing);
+        m_column_total_heights = QList<double>(m_column_count,0);
+        m_column_items = QList<QList<int>>(m_column_count);
+        m_rects.clear();
+        placeItems(0,m_item_store!=nullptr ? m_item_store->count() : 0);
+        viewport()->update();
+    }
+
+    void placeItems(int first_index,int end_index){
+        if(first_index!=m_rects.length()){
+            relayout();
+            return;
+        }
+        if(m_item_store==nullptr || first_index==end_index){
+            updateScrollBar();
+            return;
+        }
+        QRect exposed = viewport()->rect().translated(QPoint(0,verticalScrollBar()->value())-boardOffset());
+        QList<int> columns(end_index-first_index);
+        m_rects.resize(end_index);
+        QMasonryPlacement::zoomPlace(m_item_store->ratios().constData()+first_index,first_index,end_index-first_index,
+                                     m_column_count,m_real_column_width,m_horizontal_spacing,m_vertical_spacing,
+                                     m_vertical_expansion,2,0,
+                                     m_column_total_heights.data(),m_rects.data()+first_index,columns.data());
+        bool visible_change = false;
+        for(int index=first_index;index<end_index;++index){
+            m_column_items[columns[index-first_index]].append(index);
+            visible_change = visible_change || m_rects[index].intersects(exposed);
+        }
+        updateScrollBar();
+        if(visible_change){
+            viewport()->update();
+        }
+    }
+
+    void updateScrollBar(){
+        int content_height = 0;
+        if(!m_column_total_heights.isEmpty()){
+            content_height = int(*std::max_element(m_column_total_heights.begin(),m_column_total_heights.end()));
+        }
+        content_height += m_board_margins.top()+m_board_margins.bottom();
+        verticalScrollBar()->setPageStep(viewport()->height());
+        verticalScrollBar()->setRange(0,std::max(0,content_height-viewport()->height()));
+    }
+};